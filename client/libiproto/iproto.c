@@ -366,6 +366,8 @@ li_connect_phase2(struct iproto_connection_t *c, u_int32_t opt) {
 	case UnixFamily:
 		addr = (struct sockaddr *)&c->serv_addr.un.addr;
 		addr_len = sizeof(c->serv_addr.un.addr.sun_family) + strlen(c->serv_addr.un.addr.sun_path);
+		if (c->serv_addr.un.addr.sun_path[0] == 0) /* abstract socket */
+			addr_len += 1 + strlen(c->serv_addr.un.addr.sun_path + 1);
 		break;
 	default:
 		abort();
@@ -488,7 +490,11 @@ li_uconnect(struct iproto_connection_t *c, const char *path, u_int32_t opt) {
 
 	memset(&c->serv_addr.un.addr, 0, sizeof(c->serv_addr.un.addr));
 	c->serv_addr.un.addr.sun_family = AF_UNIX;
+	if (strlen(path) + 1 > sizeof(c->serv_addr.un.addr.sun_path))
+		return ERR_CODE_HOST_UNKNOWN;
 	strcpy(c->serv_addr.un.addr.sun_path, path);
+	if (path[0] == '@') /* Linux abstract socket */
+		c->serv_addr.un.addr.sun_path[0] = 0;
 
 	if ((c->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
 		return ERR_CODE_CONNECT_ERR;
@@ -162,6 +162,7 @@ struct iproto_request_t;
 struct iproto_connection_t*	li_conn_init(memalloc sp_alloc, struct memory_arena_pool_t *rap,
 					     struct memory_arena_pool_t *reqap /* optional, request arena */ );
 u_int32_t			li_connect(struct iproto_connection_t *c, const char *server, int port, u_int32_t opt);
+// path starting with '@' names a Linux abstract socket
 u_int32_t			li_uconnect(struct iproto_connection_t *c, const char *path, u_int32_t opt);
 // connect with timeout (msec)
 u_int32_t			li_connect_timeout(struct iproto_connection_t *c, const char *server, int port, u_int32_t opt, u_int32_t timeout);
@@ -66,6 +66,8 @@ static inline bool not_sched(struct Fiber* fib) { return fib != sched; }
 	enum {WAKE_VALUE=1, WAKE_ERROR} wake_flag;
 	int   ushard;
 	void *txn;
+	u64   trace; /* sampled iproto request being executed, see fiber_trace() */
+	double trace_ts;
 
 #if CFG_lua_path
 	struct lua_State *L;
@@ -127,6 +129,25 @@ void *fiber_yield(void);
 void resume(struct Fiber *callee, void *w);
 void *yield(void);
 #endif
+enum iproto_trace_stage {
+	IPROTO_TRACE_READ = 1,
+	IPROTO_TRACE_CLASSIFY,
+	IPROTO_TRACE_QUEUED,
+	IPROTO_TRACE_CB_START,
+	IPROTO_TRACE_CB_DONE,
+	IPROTO_TRACE_WAL_SUBMIT,
+	IPROTO_TRACE_WAL_DONE,
+	IPROTO_TRACE_WRITE
+};
+/* stamps sampled request executed by the current fiber, set by iproto */
+extern void (*fiber_trace_hook)(enum iproto_trace_stage stage);
+static inline void
+fiber_trace(enum iproto_trace_stage stage)
+{
+	if (unlikely(fiber->trace != 0))
+		fiber_trace_hook(stage);
+}
+
 int fiber_wake(struct Fiber *f, void *arg);
 int fiber_cancel_wake(struct Fiber *f);
 
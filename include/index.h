@@ -35,6 +35,7 @@
 #include <string.h>
 #include <third_party/twltree/twltree.h>
 #include <third_party/nihtree/nihtree.h>
+#include <third_party/art.h>
 
 
 union index_field {
@@ -77,13 +78,13 @@ struct index_field_desc {
 };
 
 enum index_type {
-	HASH, NUMHASH, SPTREE, FASTTREE, COMPACTTREE, POSTREE, PHASH, MAX_INDEX_TYPE
+	HASH, NUMHASH, SPTREE, FASTTREE, COMPACTTREE, POSTREE, PHASH, ARTTREE, MAX_INDEX_TYPE
 };
 static inline bool index_type_is_hash(enum index_type tp) {
 	return tp == HASH || tp == NUMHASH || tp == PHASH;
 }
 static inline bool index_type_is_tree(enum index_type tp) {
-	return tp == SPTREE || tp == FASTTREE || tp == COMPACTTREE || tp == POSTREE;
+	return tp == SPTREE || tp == FASTTREE || tp == COMPACTTREE || tp == POSTREE || tp == ARTTREE;
 }
 
 struct index_conf {
@@ -135,6 +136,7 @@ typedef struct tnt_object* tnt_ptr;
    iterator_init_with_node:
    iterator_init_with_object:
    iterator_next
+   find_many:count:result:
 */
 
 @protocol BasicIndex
@@ -187,8 +189,18 @@ typedef struct tnt_object* tnt_ptr;
 /* common method */
 - (int)eq:(struct tnt_object *)a :(struct tnt_object*)b;
 - (struct tnt_object *)find:(const char *)key;
+/* find_node: of n nodes laid out node_size apart, misses are NULL.
+   hashes prefetch buckets of a whole batch before resolving it */
+- (void)find_many:(const struct index_node *)nodes count:(u32)n result:(struct tnt_object **)objs;
 - (u32)size;
 - (const char *)info;
+
+/* bulk build of empty index during snapshot loading:
+   objects are collected by bulk_add:, bulk_sort may be run by
+   a worker thread and bulk_commit builds the index at once */
+- (void)bulk_add:(struct tnt_object *)obj;
+- (bool)bulk_sort;
+- (void)bulk_commit;
 @end
 static inline bool index_is_hash(const Index* index) {
 	return index_type_is_hash(index->conf.type);
@@ -208,9 +220,24 @@ static inline bool index_is_tree(const Index* index) {
 
 @interface Hash: Index {
 	size_t iter;
+@public
+	Hash *resize_next;
+	bool resize_queued;
+	u32 resize_want; /* resize: requested while another one is running */
 }
+/* move up to n slots of incremental resize, false when it is over */
+- (bool) resize_step:(u32)n;
+- (double) resize_progress;
 @end
 
+/* hash with unfinished resize: "hash/resize" fiber completes it
+   when event loop is idle. Slots move to the new table only when the
+   last one is copied, so positions of iterator_init_pos:/iterator_next
+   are valid until that moment: an iterator kept across yield() (or
+   writes, each of them moves a few slots) may skip or repeat entries.
+   Such scans must not yield, or start again from a key */
+void hash_resize_enqueue(Hash *h);
+
 @interface PHash: Index
 @end
 
@@ -249,7 +276,10 @@ typedef int (*index_cmp)(const void *, const void *, void *);
 @end
 
 typedef void (*ixsort_on_duplicate)(void* arg, struct index_node* a, struct index_node* b, uint32_t position);
-@interface Tree: Index <BasicIndex, IterIndex>
+@interface Tree: Index <BasicIndex, IterIndex> {
+	void *bulk_nodes;
+	size_t bulk_count, bulk_size;
+}
 - (void)set_sorted_nodes:(void *)nodes_ count:(size_t)count;
 - (bool)sort_nodes:(void *)nodes_ count:(size_t)count onduplicate:(ixsort_on_duplicate)ondup arg:(void*)arg;
 @end
@@ -295,6 +325,20 @@ typedef void (*ixsort_on_duplicate)(void* arg, struct index_node* a, struct inde
 @interface NIHCompactTree : NIHTree
 @end
 
+/* adaptive radix tree over memcmp() comparable encoding of index node,
+   keys are rebuilt from objects on demand, see third_party/art.h */
+@interface ARTTree : Tree {
+@public
+	struct art tree;
+	struct art_iter iter;
+	u8 *key, *leaf_key;
+	size_t key_size, leaf_key_size;
+
+	struct index_node node_b;
+	union index_field __padding_b[7];
+}
+@end
+
 @interface IndexError: Error
 @end
 
@@ -75,6 +75,9 @@ void iproto_error(struct netmsg_head *h, const struct iproto *request, u32 ret_c
 void iproto_error_fmt(struct netmsg_head *h, const struct iproto *request, u32 ret_code, const char *fmt, ...);
 
 
+struct iproto_io;
+struct iproto_io_conn;
+
 LIST_HEAD(iproto_future_list, iproto_future);
 @interface iproto_ingress: netmsg_io {
 @public
@@ -82,6 +85,7 @@ LIST_HEAD(iproto_future_list, iproto_future);
 }
 - (id)init:(int)fd_ pool:(struct netmsg_pool_ctx *)ctx;
 - (void)packet_ready:(struct iproto *)msg;
+- (void)reply_ready; /* reply is appended to wbuf out of worker, e.g. by proxy */
 @end
 
 @interface iproto_ingress_svc: iproto_ingress {
@@ -89,8 +93,19 @@ LIST_HEAD(iproto_future_list, iproto_future);
 	LIST_ENTRY(iproto_ingress_svc) link, prepare_link;
 	TAILQ_ENTRY(iproto_ingress_svc) processing_link;
 	struct iproto_service *service;
-	int batch;
+	int weight;		/* share of the service in deficit round robin, >= 1.
+				   set by iproto_peer_weight, ingress_class
+				   may change it in -init:service: */
+	int deficit;		/* request cost this client may dispatch in the current round */
+	int inflight;		/* requests running in worker fibers */
+	ev_tstamp pending_since;
+	ev_tstamp wait_time;	/* total time requests waited for dispatch */
+	u64 dispatched;
 	ev_tstamp input_overflow_warn;
+	ev_tstamp read_ts;
+	u64 trace_write;	/* sampled request whose reply is not written yet */
+	ev_tstamp trace_write_ts;
+	struct iproto_io_conn *io_conn; /* socket is served by an I/O thread */
 }
 - (void)init:(int)fd_ service:(struct iproto_service *)service_;
 @end
@@ -102,6 +117,10 @@ LIST_HEAD(iproto_future_list, iproto_future);
 	int unsent_limit;
 	SLIST_ENTRY(iproto_egress) link;
 	TAILQ_HEAD(,iproto_future) future;
+	struct iproto_egress *pool_next; /* more connections to the same peer */
+	bool pool_member;
+	int inflight;	/* requests waiting for reply */
+	ev_tstamp rtt;	/* smoothed round trip time */
 }
 @end
 SLIST_HEAD(iproto_egress_list, iproto_egress);
@@ -115,10 +134,12 @@ void iproto_ping(struct netmsg_head *h, struct iproto *r);
 enum { IPROTO_NONBLOCK = 1, IPROTO_LOCAL = 2, IPROTO_ON_MASTER = 4, IPROTO_DROP_ERROR = 8,
        IPROTO_WLOCK = 16};
 typedef void (*iproto_cb)(struct netmsg_head *, struct iproto *);
+struct iproto_pending;
 struct iproto_handler {
 	iproto_cb cb;
 	int flags;
 	int code;
+	int cost; /* charged against client's deficit, 0 means 1 */
 };
 
 struct iproto_service {
@@ -128,21 +149,46 @@ struct iproto_service {
 	LIST_HEAD(, iproto_ingress_svc) clients, prepare;
 	struct Fiber *acceptor;
 	SLIST_HEAD(, Fiber) workers; /* <- handlers */
+	int worker_cnt, worker_idle; /* all iproto_worker fibers / fibers in workers */
+	int worker_spawned; /* extra workers, started on starvation */
+	int worker_idle_min;
+	ev_tstamp worker_idle_check;
+	STAILQ_HEAD(, iproto_pending) pending; /* blocking requests waiting for a worker */
+	int pending_cnt;
+	SLIST_ENTRY(iproto_service) link;
 	int batch;
 	ev_prepare wakeup;
 	ev_prepare writeall;
 
-	enum { SERVICE_SHARDED = 1 } options;
+	enum { SERVICE_SHARDED = 1,
+	       SERVICE_IO_URING = 2, /* netmsg_io over io_uring, if available */
+	       SERVICE_BATCH_WRITES = 4 /* replies of all connections are
+					   written by one io_uring submission */
+	} options;
 	struct iproto_handler default_handler;
 	int ih_size, ih_mask;
 	struct iproto_handler *ih;
 	Class ingress_class;
 	void (*on_bind)(int fd);
 	const char *addr;
+	struct iproto_io *io; /* I/O threads, see iproto_io_threads */
+	u32 trace_seq; /* requests counted by iproto_trace_sample */
 };
 void iproto_service(struct iproto_service *service, const char *addr);
 void iproto_service_info(struct tbuf *out, struct iproto_service *service);
 void iproto_worker(va_list ap);
+
+struct iproto_trace_rec {
+	double ts;
+	u32 sync;
+	u16 msg_code;
+	u16 shard_id;
+	u32 fid;
+	u8 stage;
+	u8 reserved[3];
+};
+void iproto_trace_info(struct tbuf *out);
+int iproto_trace_save(const char *filename);
 #define SERVICE_DEFAULT_CAPA 0x100
 void service_set_handler(struct iproto_service *s, struct iproto_handler h);
 static inline struct iproto_handler *service_find_code(struct iproto_service *s, int code)
@@ -160,12 +206,15 @@ static inline struct iproto_handler *service_find_code(struct iproto_service *s,
 
 void
 service_register_iproto(struct iproto_service *s, u32 cmd, iproto_cb cb, int flags);
+/* must be called after the handler of cmd is registered */
+void service_set_cost(struct iproto_service *s, u32 cmd, int cost);
 
 struct iproto_future {
 	TAILQ_ENTRY(iproto_future) link; /* shared by connection->future and mbox */
 	LIST_ENTRY(iproto_future) waiting_link; /* ingres, who waits for reply: either proxy or mbox */
 	struct iproto_egress *dst; /* always exists and connected */
 	u32 sync; /* new sync */
+	ev_tstamp sent;
 	union {
 		struct {
 			struct iproto_ingress *ingress; /* always exists and connected */
@@ -221,6 +270,7 @@ u32 iproto_proxy_send(struct iproto_egress *to, struct iproto_ingress *from,
 		      u32 wrap_code, const struct iproto *msg, const struct iovec *iov, int iovcnt);
 
 struct iproto_egress *iproto_remote_add_peer(struct iproto_egress *peer, const struct sockaddr_in *daddr, struct netmsg_pool_ctx *ctx);
+struct iproto_egress *iproto_remote_add_peer_pool(const struct sockaddr_in *daddr, struct netmsg_pool_ctx *ctx, int size);
 void iproto_remote_stop_reconnect(struct iproto_egress *peer);
 
 @interface IProtoError : Error {
@@ -131,12 +131,15 @@ typedef void (follow_cb)(ev_stat *w, int events);
 - (id) init_dirname:(const char *)dirname_;
 - (XLog *) open_for_read:(i64)lsn;
 - (XLog *) open_for_write:(i64)lsn scn:(const i64 *)shard_scn_map;
+- (XLog *) open_for_write:(i64)lsn scn:(const i64 *)shard_scn_map spare:(const char *)spare_filename;
+- (XLog *) open_for_write:(i64)lsn scn:(const i64 *)shard_scn_map part:(int)part of:(int)parts;
 - (XLog *) find_with_lsn:(i64)lsn;
 - (XLog *) find_with_scn:(i64)scn shard:(int)shard_id;
 - (i64) greatest_lsn;
 - (int) lock;
 - (int) stat:(struct stat *)buf;
 - (int) sync;
+- (void) remove_orphan_parts;
 @end
 
 @interface SnapDir: XLogDir
@@ -208,6 +211,7 @@ typedef struct marker_desc {
 	} mode;
 
 	bool no_wet, inprogress;
+	bool abandoned; /* see -abandon */
 
 	size_t bytes_written, wet_rows_offset_size;
 	off_t offset, alloced, *wet_rows_offset;
@@ -222,6 +226,9 @@ typedef struct marker_desc {
 - (int) inprogress_rename;
 - (int) read_header;
 - (int) write_header:(i64 *)shard_scn_map;
+/* free stream left unread on error path: -free panics on a
+   readable file without valid rows */
+- (id) abandon;
 - (int) flush;
 - (void) fadvise_dont_need;
 - (size_t) rows;
@@ -235,6 +242,10 @@ typedef struct marker_desc {
 - (int) fileno;
 - (int) write_eof_marker;
 - (marker_desc_t) marker_desc;
+- (int) seek:(off_t)pos;
+/* snapshot shard section index: shard_id == -1 marks end of the last section */
+- (int) mark_section:(int)shard_id;
+- (int) write_section_index;
 @end
 
 struct tbuf *convert_row_v11_to_v12(struct tbuf *orig);
@@ -250,7 +261,31 @@ u16 fix_tag_v2(u16 tag);
 @interface XLog11: XLog
 @end
 
-@interface XLog12: XLog
+@interface XLog12: XLog {
+@public
+	/* offsets of snapshot shard sections, stored in the header */
+	int section_count;
+	u16 *section_shard;
+	off_t *section_offset, sections_end, section_index_offset;
+	i64 *header_scn; /* SCN of shards from the header, by shard_id */
+	/* snapshot split into part files: part 0 is the manifest.
+	   -fetch_row of manifest returns rows of parts 1..part_count
+	   after snap_initial, next_part > part_count when they are read */
+	int part, part_count, next_part;
+	XLog *part_stream;
+}
+- (int) write_row:(const struct row_v12 *)row data:(const void *)data;
+/* section index lists every shard of the header once, in file order */
+- (bool) valid_section_index;
+@end
+
+/* v13: rows are packed into lz4 compressed blocks with per-block crc32c */
+@interface XLog13: XLog12 {
+	char *block, *zblock;
+	size_t block_size, zblock_size;
+	u32 block_len, block_pos, block_rows;
+	size_t zbytes;
+}
 @end
 
 struct wal_pack {
@@ -274,10 +309,24 @@ struct wal_reply {
 	u32 packet_len;
 	u32 row_count, crc_count;
 	i64 seq, epoch, lsn, scn;
+	/* set only in first reply of a group */
+	u32 group_requests, group_rows;
+	float fsync_time;
 
 	struct run_crc_hist row_crc[];
 } __attribute__((packed));
 
+/* shared page, mapped before the fork server starts: the WAL writer reports
+   fdatasync latency, snapshot writers adapt their IO rate to it */
+struct wal_io_stat {
+	volatile double fsync_time; /* moving average */
+	volatile u64 fsync_count;
+	volatile double fsync_start; /* fdatasync in flight, 0 if none */
+};
+extern struct wal_io_stat *wal_io_stat;
+void wal_io_stat_start(void);
+void wal_io_stat_report(ev_tstamp fsync_time);
+
 
 void wal_pack_prepare(XLogWriter *r, struct wal_pack *);
 u32 wal_pack_append_row(struct wal_pack *pack, struct row_v12 *row);
@@ -581,6 +630,8 @@ struct octopus_cfg_peer *cfg_peer_by_name(const char *name);
 @interface DefaultExecutor : Object {
 @public
 	Shard<Shard> *shard;
+	id *bulk_index;
+	int bulk_index_count;
 }
 - (id) init;
 - (void) set_shard:(Shard<Shard> *)shard_;
@@ -588,6 +639,11 @@ struct octopus_cfg_peer *cfg_peer_by_name(const char *name);
 - (void) wal_final_row;
 - (void) status_changed;
 - (void) print:(const struct row_v12 *)row into:(struct tbuf *)buf;
+/* indexes fed by -[Index bulk_add:] while loading snapshot.
+   they are sorted in parallel and built by -bulk_build
+   at the end of shard's snapshot section */
+- (void) bulk_index:(id)index;
+- (void) bulk_build;
 @end
 
 @interface DefaultExecutor (SnapFinal)
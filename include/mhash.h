@@ -147,7 +147,9 @@ struct cstr_slot {
 
 #ifndef MH_INCREMENTAL_RESIZE
 #define MH_INCREMENTAL_RESIZE 0
-/* incremental resize interacts badly with slot mutation and should be enabled explicitly */
+/* incremental resize keeps old table authoritative and mirrors every write
+   below resize_position into the shadow: slots must not be mutated
+   in place (pvalue() is const) and must be enabled explicitly */
 #endif
 
 #ifdef MH_INCREMENTAL_CONST
@@ -246,6 +248,7 @@ typedef typeof(mh_slot_val((mh_slot_t *)0)) _mh(val_t);
 # define mh_setexist(h, i, hk)	h->map[i] |= hk
 # define mh_dirty(h, i)		(h->map[i] & 1)
 # define mh_setdirty(h, i)	h->map[i] |= 1
+# define mh_map_ptr(h, i)	(&h->map[i])
 #else
 # define mh_divider		1
 # define mh_map_t		uint32_t
@@ -256,6 +259,7 @@ typedef typeof(mh_slot_val((mh_slot_t *)0)) _mh(val_t);
 # define mh_setexist(h, i, hk)	({ (void)(hk); h->map[(i) >> 4] |= (1u << ((i) & 0xf)); })
 # define mh_dirty(h, i)		(h->map[(i) >> 4] & (1u << (((i) & 0xf) + 0x10)))
 # define mh_setdirty(h, i)	h->map[(i) >> 4] |= (0x10000u << ((i) & 0xf))
+# define mh_map_ptr(h, i)	(&h->map[(i) >> 4])
 #endif
 #endif
 
@@ -337,11 +341,18 @@ static inline void _mh(slot_copy)(struct mhash_t *d, uint32_t dx, mh_slot_t cons
 MH_DECL void _mh(slot_copy_to_shadow)(struct mhash_t *h, uint32_t o, int exist);
 
 #define mh_malloc(h, size) (h)->realloc(NULL, (size))
+/* mh_zalloc(size) returns zeroed memory which h->realloc() is able to free:
+   fresh pages of calloc() aren't touched until used, so start_resize()
+   doesn't stall on memset of the new table */
+#ifdef mh_zalloc
+#define mh_calloc(h, nmemb, size) mh_zalloc((size_t)(size) * (nmemb))
+#else
 #define mh_calloc(h, nmemb, size) ({			\
 	size_t __size = (size) * (nmemb);		\
 	void *__ptr = (h)->realloc(NULL, __size);	\
 	memset(__ptr, 0, __size);			\
 	__ptr; })
+#endif
 #define mh_free(h, ptr) (h)->realloc((ptr), 0)
 
 #ifdef MH_DEBUG
@@ -536,9 +547,8 @@ static inline void _mh(find_loop_step)(struct _mh(find_loop) *l, unsigned mask)
 }
 
 static inline uint32_t
-_mh(get)(const struct mhash_t *h, mh_key_t key)
+_mh(hget)(const struct mhash_t *h, mh_key_t key, unsigned k)
 {
-	unsigned k = mh_hash(h, key);
 	mh_map_t hk = mh_get_hashik(k);
 	struct _mh(find_loop) l;
 	_mh(find_loop_init)(&l, k, h->n_mask);
@@ -553,6 +563,36 @@ _mh(get)(const struct mhash_t *h, mh_key_t key)
 	}
 }
 
+static inline uint32_t
+_mh(get)(const struct mhash_t *h, mh_key_t key)
+{
+	return _mh(hget)(h, key, mh_hash(h, key));
+}
+
+#ifndef MH_BATCH
+#define MH_BATCH 16
+#endif
+/* batched get(): keys are hashed and their first probes prefetched
+   before any of them is resolved, so cache misses overlap */
+static inline void
+_mh(get_many)(const struct mhash_t *h, mh_key_t const *keys, uint32_t n, uint32_t *x)
+{
+	unsigned k[MH_BATCH];
+	for (uint32_t b = 0; b < n; b += MH_BATCH) {
+		uint32_t m = n - b < MH_BATCH ? n - b : MH_BATCH;
+		for (uint32_t i = 0; i < m; i++) {
+			k[i] = mh_hash(h, keys[b + i]);
+			uint32_t x0 = k[i] & h->n_mask;
+			__builtin_prefetch(mh_slot(h, x0));
+#ifdef mh_map_ptr
+			__builtin_prefetch(mh_map_ptr(h, x0));
+#endif
+		}
+		for (uint32_t i = 0; i < m; i++)
+			x[b + i] = _mh(hget)(h, keys[b + i], k[i]);
+	}
+}
+
 static inline uint32_t
 _mh(short_mark)(struct mhash_t *h, mh_key_t key)
 {
@@ -696,6 +736,21 @@ _mh(sget)(const struct mhash_t *h, mh_slot_t const *slot)
 	return _mh(get)(h, mh_slot_key(h, slot));
 }
 
+/* slots are `stride' bytes apart */
+static inline void
+_mh(sget_many)(const struct mhash_t *h, void const *slots, size_t stride, uint32_t n, uint32_t *x)
+{
+	mh_key_t keys[MH_BATCH];
+	for (uint32_t b = 0; b < n; b += MH_BATCH) {
+		uint32_t m = n - b < MH_BATCH ? n - b : MH_BATCH;
+		for (uint32_t i = 0; i < m; i++) {
+			mh_slot_t const *slot = (void const *)((char const *)slots + (b + i) * stride);
+			keys[i] = mh_slot_key(h, slot);
+		}
+		_mh(get_many)(h, keys, m, x + b);
+	}
+}
+
 static inline int
 _mh(sput)(struct mhash_t *h, mh_slot_t const *slot, mh_slot_t *prev_slot)
 {
@@ -992,7 +1047,7 @@ _mh(start_resize)(struct mhash_t *h, uint32_t want_size)
 MH_DECL size_t
 _mh(bytes)(struct mhash_t *h)
 {
-	return h->resize_position ? _mh(bytes)(h->shadow) : 0 +
+	return (h->resize_position ? _mh(bytes)(h->shadow) : 0) +
 		sizeof(*h) +
 		((size_t)mh_end(h)) * mh_slot_size(h) +
 #ifndef mh_custom_map
@@ -1098,6 +1153,7 @@ _mh(dump)(struct mhash_t *h)
 #undef mh_setexist
 #undef mh_dirty
 #undef mh_setdirty
+#undef mh_map_ptr
 
 #undef mh_malloc
 #undef mh_calloc
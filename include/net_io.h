@@ -45,10 +45,13 @@ struct service;
 struct netmsg;
 TAILQ_HEAD(netmsg_tailq, netmsg);
 
+struct rbuf_chunk;
 struct netmsg_pool_ctx {
 	struct palloc_pool *pool;
 	struct palloc_config cfg;
 	int limit;
+	int rchunk_size; /* > 0 : connections share receive buffer chunks */
+	struct rbuf_chunk *rchunk, *rchunk_spare;
 };
 
 struct netmsg_head {
@@ -73,15 +76,36 @@ struct netmsg {
 	uintptr_t ref[NETMSG_IOV_SIZE];
 };
 
+/* Streaming output: the cursor is pulled for more messages whenever the
+   connection has less than output_low_watermark bytes pending, so a huge
+   result is produced while it is being sent. pull() must append complete
+   messages to h (other replies may be appended between pulls) and returns
+   false once exhausted, releasing its resources. If the connection is closed
+   first, pull() is called with h == NULL to release them. If pull() raises,
+   the connection is closed.
+   Pulls run from the event loop, requests are executed between them: an
+   index iterator must not be kept from one pull to the next. Writes, hash
+   resize steps and ART node replacement invalidate it; keep the last
+   object (referenced) or key instead and seek again on every pull. */
+struct netmsg_cursor {
+	TAILQ_ENTRY(netmsg_cursor) link;
+	bool (*pull)(struct netmsg_cursor *c, struct netmsg_head *h);
+};
+
 #define NETMSG_IO_SHARED_POOL	1
 #define NETMSG_IO_LINGER_CLOSE	2
+#define NETMSG_IO_URING		4 /* served by io_uring, see netmsg_uring_attach() */
+#define NETMSG_IO_URING_WRITE	8 /* only output goes through io_uring */
 @interface netmsg_io : Object {
 @public
 	struct netmsg_pool_ctx *ctx;
 	struct tbuf rbuf;
+	struct rbuf_chunk *rchunk; /* rbuf is a slice of shared chunk */
 	struct netmsg_head wbuf;
 	ev_io in, out;
 	int fd, rc, flags;
+	struct netmsg_uring *uring;
+	TAILQ_HEAD(, netmsg_cursor) cursors;
 }
 - (void)release; /* do not override : IMP caching in process_requests()  */
 - (id)retain; /* do not override : IMP caching in process_requests()  */
@@ -89,6 +113,7 @@ struct netmsg {
 - (void)linger_close;
 - (void)data_ready;
 - (void)tac_event:(int)fd; /* called on tcp_async_connect() result */
+- (void)uring_written:(ssize_t)r; /* io_uring write completion */
 @end
 
 struct netmsg_mark {
@@ -99,6 +124,7 @@ struct netmsg_mark {
 
 void netmsg_pool_ctx_init(struct netmsg_pool_ctx *ctx, const char *name, int limit);
 void netmsg_pool_ctx_gc(struct netmsg_pool_ctx *ctx);
+void netmsg_pool_ctx_shared_rbuf(struct netmsg_pool_ctx *ctx, int chunk_size);
 
 void netmsg_head_init(struct netmsg_head *h, struct netmsg_pool_ctx *ctx);
 void netmsg_head_dealloc(struct netmsg_head *h);
@@ -107,6 +133,7 @@ struct netmsg *netmsg_concat(struct netmsg_head *dst, struct netmsg_head *src);
 void netmsg_rewind(struct netmsg_head *h, const struct netmsg_mark *mark);
 void netmsg_getmark(struct netmsg_head *h, struct netmsg_mark *mark);
 void netmsg_reset(struct netmsg_head *h);
+void netmsg_flatten(struct netmsg_head *h, void *buf);
 
 void net_add_iov(struct netmsg_head *o, const void *buf, size_t len);
 void *net_add_alloc(struct netmsg_head *o, size_t len);
@@ -118,6 +145,20 @@ void net_add_obj_iov(struct netmsg_head *o, struct tnt_object *obj, const void *
 void netmsg_verify_ownership(struct netmsg_head *h); /* debug method */
 
 ssize_t netmsg_writev(int fd, struct netmsg_head *head);
+void netmsg_drop(struct netmsg_head *h, size_t bytes);
+
+/* io_uring transport: attach fails if io_uring is unavailable.
+   mode is either NETMSG_IO_URING or NETMSG_IO_URING_WRITE.
+   Queued operations are submitted by netmsg_uring_submit(), which must
+   be called once per event loop iteration; it returns number of them
+   and stores number of write SQEs among them into *writes, if non-NULL */
+int netmsg_uring_attach(struct netmsg_io *io, int mode);
+void netmsg_uring_recv_start(struct netmsg_io *io);
+void netmsg_uring_recv_stop(struct netmsg_io *io);
+void netmsg_uring_write(struct netmsg_io *io);
+int netmsg_uring_submit(int *writes);
+/* output moved out of wbuf into sendmsg_zc and not yet sent */
+size_t netmsg_uring_inflight(struct netmsg_io *io);
 
 void netmsg_io_init(struct netmsg_io *io, struct netmsg_pool_ctx *ctx, int fd);
 
@@ -141,6 +182,10 @@ static inline void netmsg_io_release(struct netmsg_io *io)
 int rbuf_len(const struct netmsg_io *io);
 void rbuf_ltrim(struct netmsg_io *io, int size);
 ssize_t rbuf_recv(struct netmsg_io *io, int size);
+void rbuf_append(struct netmsg_io *io, const void *data, int len);
+
+void netmsg_io_add_cursor(struct netmsg_io *io, struct netmsg_cursor *c);
+int netmsg_io_pull(struct netmsg_io *io, size_t queued);
 
 enum tac_result {
 	tac_error = -1,
@@ -178,11 +223,13 @@ struct tcp_server_state {
 void tcp_server(va_list ap);
 void tcp_server_stop(struct tcp_server_state *state);
 void udp_server(va_list ap);
-int server_socket(int type, struct sockaddr *saddr, int nonblock,
+enum { SERVER_SOCKET_NONBLOCK = 1, SERVER_SOCKET_REUSEPORT = 2 };
+int server_socket(int type, struct sockaddr *saddr, int flags,
 		  void (*on_bind)(int fd), void (*sleep)(ev_tstamp tm));
 
 int atosin(const char *orig, struct sockaddr_in *addr);
 int atosun(const char *orig, struct sockaddr_un *addr);
+socklen_t sunlen(const struct sockaddr_un *addr);
 int atosaddr(const char *orig, struct sockaddr *addr);
 const char *sintoa(const struct sockaddr_in *addr);
 const char *saddrtoa(const struct sockaddr *addr);
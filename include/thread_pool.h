@@ -70,6 +70,8 @@ typedef struct _thread_responses {
 	volatile thread_pool_request *last;
 	ev_io ev;
 	int ev_started;
+	int closing; /* threads yet to exit, see -[ThreadPool close] */
+	struct Fiber *closer;
 } thread_responses;
 
 void thread_responses_init(thread_responses *queue);
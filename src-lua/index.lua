@@ -15,6 +15,7 @@ local pcall = pcall
 local table = table
 local assertarg = assertarg
 local setmetatable = setmetatable
+local unpack = unpack
 
 local ipairs, pairs = ipairs, pairs
 local string = string
@@ -27,6 +28,8 @@ ffi.cdef[[
 struct BasicIndex {
 	struct { void *isa; };
 	const struct index_conf conf;
+	void *next;
+	const size_t node_size;
 };
 struct Tree {
 	struct { void *isa; };
@@ -35,6 +38,7 @@ struct Tree {
 ]]
 
 local find_node = objc.msg_lookup('find_node:')
+local find_many = objc.msg_lookup('find_many:count:result:')
 local iterator_init = objc.msg_lookup("iterator_init")
 local iterator_init_with_node = objc.msg_lookup("iterator_init_with_node:")
 local iterator_init_with_object = objc.msg_lookup("iterator_init_with_object:")
@@ -54,6 +58,10 @@ local node = ffi.cast('struct index_node *', ffi.C.malloc(maxnodesize))
 local strbuf = ffi.new('char[?]', 5 + 0xffff)
 gen = {node = node, strbuf = strbuf}
 
+-- find_many() batch buffers, grown on demand
+local many_cap = 0
+local many_nodes, many_objs
+
 local cgen_mt = {
     __index = {
         emit = function (self, fmt, lbindings)
@@ -242,6 +250,35 @@ local basic_mt = {
             local node = self:packnode(...)
             return object(self.__visible(find_node(self.__ptr, node)))
         end,
+        -- index:find_many({k1, k2, {k3a, k3b}, ...}) returns array of
+        -- the same length, nil for missing keys. hashes look up the
+        -- whole batch with prefetch, so multiget is way cheaper than
+        -- a loop of find()
+        find_many = function(self, keys)
+            local n = #keys
+            local nsize = tonumber(self.__ptr.node_size)
+            if n > many_cap then
+                many_cap = n
+                many_nodes = ffi.new('char[?]', n * maxnodesize)
+                many_objs = ffi.new('struct tnt_object *[?]', n)
+            end
+            for i = 1, n do
+                local key = keys[i]
+                local node
+                if type(key) == 'table' then
+                    node = self:packnode(unpack(key))
+                else
+                    node = self:packnode(key)
+                end
+                ffi.copy(many_nodes + (i - 1) * nsize, node, nsize)
+            end
+            find_many(self.__ptr, many_nodes, ffi.cast(uint32_t, n), many_objs)
+            local res = {}
+            for i = 1, n do
+                res[i] = object(self.__visible(many_objs[i - 1]))
+            end
+            return res
+        end,
         size = function(self)
             return tonumber(ffi.cast(uint32_t, objc.msg_send(self.__ptr, "size")))
         end,
@@ -252,7 +289,7 @@ local basic_mt = {
             local tpe = self.__ptr.conf.type
             if tpe == ffi.C.HASH or tpe == ffi.C.NUMHASH or tpe == ffi.C.PHASH then
                 return "HASH"
-            elseif tpe == ffi.C.COMPACTTREE or tpe == ffi.C.FASTTREE or tpe == ffi.C.SPTREE or tpe == ffi.C.POSTREE then
+            elseif tpe == ffi.C.COMPACTTREE or tpe == ffi.C.FASTTREE or tpe == ffi.C.SPTREE or tpe == ffi.C.POSTREE or tpe == ffi.C.ARTTREE then
                 return "TREE"
             else
                 error("bad index type: "..tpe, 2)
@@ -362,6 +399,7 @@ local index_mt = {
     [tonumber(ffi.C.FASTTREE)] = tree_mt,
     [tonumber(ffi.C.COMPACTTREE)] = tree_mt,
     [tonumber(ffi.C.POSTREE)] = postree_mt,
+    [tonumber(ffi.C.ARTTREE)] = tree_mt,
     [tonumber(ffi.C.HASH)] = hash_mt,
     [tonumber(ffi.C.NUMHASH)] = hash_mt,
     [tonumber(ffi.C.PHASH)] = hash_mt,
@@ -35,6 +35,7 @@
 #import <tbuf.h>
 #import <net_io.h>
 #import <pickle.h>
+#import <iproto.h>
 
 #include <third_party/luajit/src/lua.h>
 
@@ -54,6 +55,8 @@ static const char help[] =
 	" - show palloc" CRLF
 	" - show stat" CRLF
 	" - show shard" CRLF
+	" - show trace" CRLF
+	" - save trace" CRLF
 	" - save coredump" CRLF
 	" - enable coredump" CRLF
 	" - save snapshot" CRLF
@@ -350,6 +353,17 @@ admin_dispatch(int fd, struct tbuf *rbuf)
 			}
 		}
 
+		action save_trace {
+			if (iproto_trace_save("iproto_trace.bin") == 0) {
+				start(out);
+				tbuf_printf(out, "ok: iproto_trace.bin" CRLF);
+				end(out);
+			} else {
+				tbuf_printf(err, "%s", strerror_o(errno));
+				fail(out, err);
+			}
+		}
+
 		action save_core {
 			if (coredump(60) >= 0) {
 				ok(out);
@@ -382,6 +396,7 @@ admin_dispatch(int fd, struct tbuf *rbuf)
 		slab = "sl"("a"("b")?)?;
 		snapshot = "sn"("a"("p"("s"("h"("o"("t")?)?)?)?)?)?;
 		stat = "st"("a"("t")?)?;
+		trace = "tr"("a"("c"("e")?)?)?;
 		string = [^\r\n]+ >{strstart = p;}  %{strend = p;};
                 net = "n"("e"("t")?)? %{ info_net = 1;};
 
@@ -397,9 +412,11 @@ admin_dispatch(int fd, struct tbuf *rbuf)
 			    show " "+ palloc		%{start(out); palloc_stat_info(out); end(out);}	|
 			    show " "+ stat		%show_stat					|
 			    show " "+ shard		%show_shard					|
+			    show " "+ trace		%{start(out); iproto_trace_info(out); end(out);}	|
 			    enable " "+ coredump        %{maximize_core_rlimit(); ok(out);}		|
 			    save " "+ coredump		%save_core					|
 			    save " "+ snapshot		%save_snapshot					|
+			    save " "+ trace		%save_trace					|
 			    incr " "+ log         	%{log_level(out, "ALL", NULL, 1); }		|
 			    decr " "+ log         	%{log_level(out, "ALL", NULL, -1); }		|
 			    incr " "+ log " "+ string	%{log_level(out, strstart, strend, 1); }	|
@@ -0,0 +1,2 @@
+#include "config.h"
+#include "third_party/art.c"
@@ -70,6 +70,7 @@ struct Fiber *fiber = nil;
 int coro_switch_cnt;
 #endif
 static uint32_t last_used_fid;
+void (*fiber_trace_hook)(enum iproto_trace_stage stage);
 
 static ev_prepare wake_prep;
 static ev_check wake_check;
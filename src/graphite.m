@@ -64,20 +64,36 @@ graphite_init()
 	int i;
 	gethostname(buf, sizeof(buf));
 	buf[64] = 0;
-	char *addr = NULL;
+	const char *addr = NULL;
+	int addr_len = 0;
 #if CFG_primary_addr
+	/* primary_addr may be a list: use its first TCP address,
+	   as iproto_service() does */
 	addr = cfg.primary_addr;
+	for (const char *a = addr; a && *a; ) {
+		int len = strcspn(a, ", ");
+		if (len > 0 && a[0] != '/' && a[0] != '.' && a[0] != '@') {
+			addr = a;
+			addr_len = len;
+			break;
+		}
+		a += len;
+		a += strspn(a, ", ");
+	}
+	if (addr && addr_len == 0)
+		addr_len = strcspn(addr, ", ");
 #endif
 	graphite_head_len = snprintf(graphite_head, sizeof(graphite_head)-1,
-			"my.octopus.%s%s%s%s",
-			buf, addr?":":"", addr?:"",
+			"my.octopus.%s%s%.*s%s",
+			buf, addr?":":"", addr_len, addr?:"",
 			cfg.custom_proc_title?:"");
 	if (graphite_head_len > sizeof(graphite_head)-1)
 		graphite_head_len = sizeof(graphite_head)-1;
-	/* between  s/[. ()]/_/ */
+	/* between  s/[. ()\/@]/_/ */
 	for (i=strlen("my.octopus."); i<graphite_head_len; i++) {
 		if (graphite_head[i] == '.' || graphite_head[i] == ' ' ||
-			graphite_head[i] == '(' || graphite_head[i] == ')') {
+			graphite_head[i] == '(' || graphite_head[i] == ')' ||
+			graphite_head[i] == '/' || graphite_head[i] == '@') {
 			graphite_head[i] = '_';
 		}
 	}
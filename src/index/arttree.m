@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2016 Mail.RU
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <util.h>
+#import <fiber.h>
+#import <index.h>
+#import <say.h>
+
+/*
+ * Index node is encoded so that memcmp() of encodings orders nodes
+ * the way `compare' does:
+ *   numbers are stored big endian, signed ones with sign bit flipped;
+ *   strings have 0x00 escaped as 0x00 0x01 and end with 0x00 0x00,
+ *   so shorter string goes first and no key is a prefix of another;
+ *   fields with DESC sort order are complemented;
+ *   non unique index appends address of the object.
+ * Pattern encodes only its significant fields and no address, which
+ * makes it a prefix of every matching key.
+ */
+
+static inline u8 *
+put_u32(u8 *p, u32 v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+	return p + 4;
+}
+
+static inline u8 *
+put_u64(u8 *p, u64 v)
+{
+	return put_u32(put_u32(p, v >> 32), v);
+}
+
+static inline void
+complement(u8 *p, u8 *end)
+{
+	for (; p < end; p++)
+		*p = ~*p;
+}
+
+/* returns length of the encoding, *exact is set if it identifies single object */
+static size_t
+art_key(ARTTree *t, const struct index_node *node, u8 **buf, size_t *size, bool *exact)
+{
+	const struct index_conf *ic = &t->conf;
+	uintptr_t obj = (uintptr_t)node->obj;
+	int n = ic->cardinality;
+	bool pattern = n == 1 ? obj <= 1 : obj < nelem(ic->field);
+	if (pattern && n > 1 && obj < n)
+		n = obj;
+
+	size_t need = sizeof(u64);
+	for (int i = 0; i < n; i++) {
+		const union index_field *f = (void *)&node->key + ic->field[i].offset;
+		need += ic->field[i].type == STRING ? 2 * f->str.len + 2 : sizeof(u64);
+	}
+	if (need > *size) {
+		*size = need * 2;
+		*buf = xrealloc(*buf, *size);
+	}
+
+	u8 *p = *buf;
+	for (int i = 0; i < n; i++) {
+		const union index_field *f = (void *)&node->key + ic->field[i].offset;
+		u8 *start = p;
+		switch (ic->field[i].type) {
+		case SNUM8:
+		case SNUM16:
+		case SNUM32:
+			p = put_u32(p, f->u32 ^ 0x80000000U);
+			break;
+		case UNUM8:
+		case UNUM16:
+		case UNUM32:
+			p = put_u32(p, f->u32);
+			break;
+		case SNUM64:
+			p = put_u64(p, f->u64 ^ 0x8000000000000000ULL);
+			break;
+		case UNUM64:
+			p = put_u64(p, f->u64);
+			break;
+		case STRING: {
+			u8 prefix[6] = { f->str.prefix1 >> 24, f->str.prefix1 >> 16,
+					 f->str.prefix1 >> 8, f->str.prefix1,
+					 f->str.prefix2 >> 8, f->str.prefix2 };
+			const u8 *tail = f->str.len <= 14 ? (u8 *)f->str.data.bytes : f->str.data.ptr;
+			for (int j = 0; j < f->str.len; j++) {
+				u8 c = j < 6 ? prefix[j] : tail[j - 6];
+				*p++ = c;
+				if (c == 0)
+					*p++ = 1;
+			}
+			*p++ = 0;
+			*p++ = 0;
+			break;
+		}
+		case UNDEF:
+			abort();
+		}
+		if (ic->field[i].sort_order == DESC)
+			complement(start, p);
+	}
+
+	if (!pattern && !ic->unique) {
+		u8 *start = p;
+		p = put_u64(p, obj);
+		/* single field comparators order duplicates with the key */
+		if (ic->cardinality == 1 && ic->field[0].sort_order == DESC)
+			complement(start, p);
+	}
+	if (exact)
+		*exact = ic->unique ? n == ic->cardinality : !pattern;
+	return p - *buf;
+}
+
+static const uint8_t *
+art_leaf_key(void *arg, const void *obj, size_t *len)
+{
+	ARTTree *t = arg;
+	t->dtor((struct tnt_object *)obj, &t->node_b, t->dtor_arg);
+	*len = art_key(t, &t->node_b, &t->leaf_key, &t->leaf_key_size, NULL);
+	return t->leaf_key;
+}
+
+static const struct art_desc art_index_desc = { .leafKey = art_leaf_key };
+
+@implementation ARTTree
+
+- (id)
+init:(const struct index_conf *)ic dtor:(const struct dtor_conf *)dc
+{
+	[super init:ic dtor:dc];
+	tree.desc = &art_index_desc;
+	return self;
+}
+
+- (u32)
+size
+{
+	return tree.size;
+}
+
+- (u32)
+slots
+{
+	return tree.size;
+}
+
+- (size_t)
+bytes
+{
+	return tree.bytes;
+}
+
+- (void)
+clear
+{
+	art_destroy(&tree);
+}
+
+- (id)
+free
+{
+	art_destroy(&tree);
+	art_iter_destroy(&iter);
+	free(key);
+	free(leaf_key);
+	return [super free];
+}
+
+- (void)
+replace:(struct tnt_object *)obj
+{
+	dtor(obj, &node_a, dtor_arg);
+	size_t len = art_key(self, &node_a, &key, &key_size, NULL);
+	art_insert(&tree, key, len, obj, self);
+}
+
+- (int)
+remove:(struct tnt_object *)obj
+{
+	dtor(obj, &node_a, dtor_arg);
+	size_t len = art_key(self, &node_a, &key, &key_size, NULL);
+	return art_delete(&tree, key, len, self) != NULL;
+}
+
+- (struct tnt_object *)
+find_node:(const struct index_node *)node
+{
+	bool exact;
+	size_t len = art_key(self, node, &key, &key_size, &exact);
+	if (exact)
+		return art_find(&tree, key, len, self);
+
+	/* partial key: first of the keys it is a prefix of */
+	struct art_iter it = { .stack = NULL };
+	art_iter_seek(&it, &tree, 1, key, len, self);
+	struct tnt_object *obj = art_iter_next(&it);
+	art_iter_destroy(&it);
+	if (obj != NULL && compare(node, GET_NODE(obj, node_b), dtor_arg) != 0)
+		return NULL;
+	return obj;
+}
+
+- (void)
+iterator_init_with_direction:(enum iterator_direction)direction
+{
+	art_iter_init(&iter, &tree, direction == iterator_forward ? 1 : -1);
+}
+
+- (void)
+iterator_init_with_node:(const struct index_node *)node direction:(enum iterator_direction)direction
+{
+	if (node != &search_pattern)
+		memcpy(&search_pattern, node, node_size);
+	size_t len = art_key(self, &search_pattern, &key, &key_size, NULL);
+	art_iter_seek(&iter, &tree, direction == iterator_forward ? 1 : -1, key, len, self);
+}
+
+- (void)
+iterator_init_with_object:(struct tnt_object *)obj direction:(enum iterator_direction)direction
+{
+	dtor(obj, &search_pattern, dtor_arg);
+	size_t len = art_key(self, &search_pattern, &key, &key_size, NULL);
+	art_iter_seek(&iter, &tree, direction == iterator_forward ? 1 : -1, key, len, self);
+}
+
+- (struct tnt_object *)
+iterator_next
+{
+	return art_iter_next(&iter);
+}
+
+- (struct tnt_object *)
+iterator_next_check:(index_cmp)check
+{
+	struct tnt_object *obj;
+	while ((obj = art_iter_next(&iter))) {
+		switch (check(&search_pattern, GET_NODE(obj, node_b), self->dtor_arg)) {
+		case 0: return obj;
+		case -1:
+		case 1: return NULL;
+		case 2: continue;
+		}
+	}
+	return NULL;
+}
+
+/* keys come in order, so inserts touch only the rightmost path */
+- (void)
+set_sorted_nodes:(void *)nodes count:(size_t)count
+{
+	art_destroy(&tree);
+	@try {
+		for (size_t i = 0; i < count; i++) {
+			struct index_node *node = nodes + i * node_size;
+			size_t len = art_key(self, node, &key, &key_size, NULL);
+			art_insert(&tree, key, len, node->obj, self);
+		}
+	} @finally {
+		free(nodes);
+	}
+}
+@end
+
+register_source();
@@ -74,6 +74,8 @@ new_conf:(const struct index_conf *)ic dtor:(const struct dtor_conf *)dc
 		i = [TWLCompactTree alloc];
 	} else if (ic->type == POSTREE) {
 		i = [NIHCompactTree alloc];
+	} else if (ic->type == ARTTREE) {
+		i = [ARTTree alloc];
 	} else {
 		abort();
 	}
@@ -218,6 +220,15 @@ find:(const char *)key
 	return [(id<BasicIndex>)self find_node: &node_a];
 }
 
+- (void)
+find_many:(const struct index_node *)nodes count:(u32)n result:(struct tnt_object **)objs
+{
+	for (u32 i = 0; i < n; i++) {
+		const struct index_node *node = (void *)nodes + i * node_size;
+		objs[i] = [(id<BasicIndex>)self find_node:node];
+	}
+}
+
 - (u32)
 size
 {
@@ -233,6 +244,23 @@ info
 	index_conf_print(b, &conf);
 	return b->ptr;
 }
+
+- (void)
+bulk_add:(struct tnt_object *)obj
+{
+	[(id<BasicIndex>)self replace:obj];
+}
+
+- (bool)
+bulk_sort
+{
+	return true;
+}
+
+- (void)
+bulk_commit
+{
+}
 @end
 
 void __attribute__((noreturn)) oct_cold
@@ -695,7 +695,7 @@ index_conf_validate(struct index_conf *d)
 		index_raise("index_conf.type is invalid");
 	//if (d->unique > 1)
 		//index_raise("index_conf.unique is not bool");
-	if (d->unique == false && (d->type == HASH || d->type == NUMHASH || d->type == PHASH))
+	if (d->unique == false && index_type_is_hash(d->type))
 		index_raise("hash index should be unique");
 
 	for (int k = 0; k < d->cardinality; k++) {
@@ -815,6 +815,7 @@ index_type(enum index_type t)
 	case COMPACTTREE: return "COMPACTTREE";
 	case POSTREE: return "POSTREE";
 	case PHASH: return "PHASH";
+	case ARTTREE: return "ARTTREE";
 	case MAX_INDEX_TYPE: break;
 	}
 	assert(false);
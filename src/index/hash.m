@@ -29,6 +29,7 @@
 #import <iproto.h>
 #import <index.h>
 #import <pickle.h>
+#import <stat.h>
 #include <third_party/qsort_arg.h>
 
 
@@ -44,6 +45,7 @@ typedef const void* cstr;
 
 #define MH_INCREMENTAL_RESIZE 1
 #define MH_STATIC 1
+#define mh_zalloc(size) xcalloc(1, (size))
 
 #define mh_var_slot(h,i) ((typeof((h)->slots))((char *)(h)->slots + (i) * mh_slot_size(h)))
 
@@ -97,8 +99,98 @@ cur_iter
 {
 	return iter;
 }
+
+- (bool)
+resize_step:(u32)n
+{
+	return false;
+}
+
+- (double)
+resize_progress
+{
+	return 1.0;
+}
+
+static Hash *resize_queue;
+static struct Fiber *resize_fiber;
+
+- (id)
+free
+{
+	if (resize_queued) {
+		Hash **p = &resize_queue;
+		while (*p != self)
+			p = &(*p)->resize_next;
+		*p = resize_next;
+	}
+	return [super free];
+}
 @end
 
+/* writes move a few slots each, the rest is done here in 1ms slices
+   whenever event loop has nothing else to do */
+static void
+hash_resize_loop(va_list ap _unused_)
+{
+	ev_idle idle = { .coro = 1 };
+	ev_idle_init(&idle, (void *)fiber);
+
+	for (;;) {
+		if (resize_queue == NULL) {
+			yield(); /* hash_resize_enqueue() wakes us */
+			continue;
+		}
+
+		ev_idle_start(&idle);
+		yield();
+		ev_idle_stop(&idle);
+
+		ev_tstamp deadline = ev_time() + 0.001;
+		while (resize_queue != NULL && ev_time() < deadline) {
+			Hash *h = resize_queue;
+			if ([h resize_step:4096])
+				continue;
+			resize_queue = h->resize_next;
+			h->resize_next = NULL;
+			h->resize_queued = false;
+		}
+	}
+}
+
+static void
+hash_resize_stat(int base _unused_)
+{
+	int n = 0;
+	double progress = 1.0;
+	for (Hash *h = resize_queue; h != NULL; h = h->resize_next) {
+		double p = [h resize_progress];
+		if (p < progress)
+			progress = p;
+		n++;
+	}
+	stat_report_gauge("HASH_RESIZING", sizeof("HASH_RESIZING"), n);
+	stat_report_gauge("HASH_RESIZE_PROGRESS", sizeof("HASH_RESIZE_PROGRESS"), progress * 100);
+}
+
+void
+hash_resize_enqueue(Hash *h)
+{
+	if (h->resize_queued)
+		return;
+
+	if (resize_fiber == NULL) {
+		stat_register_callback("index_hash", hash_resize_stat);
+		resize_fiber = fiber_create("hash/resize", hash_resize_loop);
+	}
+
+	if (resize_queue == NULL)
+		fiber_wake(resize_fiber, NULL);
+	h->resize_queued = true;
+	h->resize_next = resize_queue;
+	resize_queue = h;
+}
+
 #define DEFINE_METHODS(type)						\
 - (id)									\
 init:(struct index_conf *)ic dtor:(const struct dtor_conf *)dc          \
@@ -128,7 +220,36 @@ get:(u32)i								\
 - (void)								\
 resize:(u32)buckets							\
 {									\
+	/* running resize is not finished at once: the new one starts	\
+	   after it in background */					\
+	if (h->resize_position) {					\
+		if (buckets > resize_want)				\
+			resize_want = buckets;				\
+		hash_resize_enqueue(self);				\
+		return;							\
+	}								\
 	mh_##type##_start_resize(h, buckets);				\
+	if (h->resize_position)						\
+		hash_resize_enqueue(self);				\
+}									\
+- (bool)								\
+resize_step:(u32)n							\
+{									\
+	for (u32 i = 0; i < n && h->resize_position; i += h->resize_batch) \
+		mh_##type##_resize_step(h);				\
+	if (h->resize_position == 0 && resize_want > 0) {		\
+		u32 buckets = resize_want;				\
+		resize_want = 0;					\
+		mh_##type##_start_resize(h, buckets);			\
+	}								\
+	return h->resize_position != 0;					\
+}									\
+- (double)								\
+resize_progress								\
+{									\
+	if (h->resize_position == 0)					\
+		return 1.0;						\
+	return (double)h->resize_position / mh_end(h);			\
 }									\
 - (struct tnt_object *)							\
 find_obj:(struct tnt_object *)obj					\
@@ -148,10 +269,23 @@ find_node:(const struct index_node *)node				\
 	return NULL;							\
 }									\
 - (void)								\
+find_many:(const struct index_node *)nodes count:(u32)n result:(struct tnt_object **)objs \
+{									\
+	u32 x[MH_BATCH];						\
+	for (u32 b = 0; b < n; b += MH_BATCH) {				\
+		u32 m = n - b < MH_BATCH ? n - b : MH_BATCH;		\
+		mh_##type##_sget_many(h, (void *)nodes + b * node_size, node_size, m, x); \
+		for (u32 i = 0; i < m; i++)				\
+			objs[b + i] = x[i] != mh_end(h) ? mh_##type##_value(h, x[i]) : NULL; \
+	}								\
+}									\
+- (void)								\
 replace:(struct tnt_object *)obj					\
 {									\
 	struct index_node *node_ = GET_NODE(obj, node_a);		\
         mh_##type##_sput(h, (void *)node_, NULL);			\
+	if (mh_unlikely(h->resize_position))				\
+		hash_resize_enqueue(self);				\
 }									\
 - (int)									\
 remove:(struct tnt_object *)obj						\
@@ -190,6 +324,8 @@ iterator_next								\
 ordered_iterator_init							\
 {									\
 	int j = 0;							\
+	while (h->resize_position)					\
+		mh_##type##_resize_step(h);				\
 	[self iterator_init];						\
 	/* assert(j + 1 == ..) assumes that hash has at least one elem */ \
 	if (mh_size(h) == 0)						\
@@ -446,7 +582,35 @@ get:(u32)i
 - (void)
 resize:(u32)buckets
 {
+	/* same as in DEFINE_METHODS: queue it after the running one */
+	if (h->resize_position) {
+		if (buckets > resize_want)
+			resize_want = buckets;
+		hash_resize_enqueue(self);
+		return;
+	}
 	mh_gen_start_resize(h, buckets);
+	if (h->resize_position)
+		hash_resize_enqueue(self);
+}
+- (bool)
+resize_step:(u32)n
+{
+	for (u32 i = 0; i < n && h->resize_position; i += h->resize_batch)
+		mh_gen_resize_step(h);
+	if (h->resize_position == 0 && resize_want > 0) {
+		u32 buckets = resize_want;
+		resize_want = 0;
+		mh_gen_start_resize(h, buckets);
+	}
+	return h->resize_position != 0;
+}
+- (double)
+resize_progress
+{
+	if (h->resize_position == 0)
+		return 1.0;
+	return (double)h->resize_position / mh_end(h);
 }
 - (struct tnt_object*)
 find_obj:(struct tnt_object*)obj
@@ -466,10 +630,26 @@ find_node:(const struct index_node *)node
 	return NULL;
 }
 - (void)
+find_many:(const struct index_node *)nodes count:(u32)n result:(struct tnt_object **)objs
+{
+	const struct index_node *keys[MH_BATCH];
+	u32 x[MH_BATCH];
+	for (u32 b = 0; b < n; b += MH_BATCH) {
+		u32 m = n - b < MH_BATCH ? n - b : MH_BATCH;
+		for (u32 i = 0; i < m; i++)
+			keys[i] = (void *)nodes + (b + i) * node_size;
+		mh_gen_get_many(h, keys, m, x);
+		for (u32 i = 0; i < m; i++)
+			objs[b + i] = x[i] != mh_end(h) ? tnt_ptr2obj(mh_gen_slot(h, x[i])->ptr) : NULL;
+	}
+}
+- (void)
 replace:(struct tnt_object *)obj
 {
 	gen_slot_t p = {.ptr = tnt_obj2ptr(obj), .hsh = 0, .collision= 0} ;
 	mh_gen_sput(h, &p, NULL);
+	if (mh_unlikely(h->resize_position))
+		hash_resize_enqueue(self);
 }
 - (int)
 remove:(struct tnt_object *)obj
@@ -502,6 +682,8 @@ iterator_next
 ordered_iterator_init
 {
 	int i = 0;
+	while (h->resize_position)
+		mh_gen_resize_step(h);
 	[self iterator_init];
 	/* assert(j + 1 == ..) assumes that hash has at least one elem */
 	if (mh_size(h) == 0)
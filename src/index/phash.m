@@ -76,6 +76,18 @@ find_node:(const struct index_node *)node
 	return ph_get_key(&h, (uintptr_t)node, self);
 }
 
+- (void)
+find_many:(const struct index_node *)nodes count:(u32)n result:(struct tnt_object **)objs
+{
+	u64 keys[16];
+	for (u32 b = 0; b < n; b += nelem(keys)) {
+		u32 m = n - b < nelem(keys) ? n - b : nelem(keys);
+		for (u32 i = 0; i < m; i++)
+			keys[i] = (uintptr_t)nodes + (b + i) * node_size;
+		ph_get_many(&h, keys, m, (void **)objs + b, self);
+	}
+}
+
 - (void)
 resize:(u32)buckets
 {
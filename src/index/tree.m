@@ -97,6 +97,30 @@ find_node:(const struct index_node *)node
 	return 0;
 }
 
+/* there is nothing to prefetch before the descent, instead a batch is
+   resolved in key order: neighbour lookups share the upper levels
+   and often the leaf page, which stay in cache */
+- (void)
+find_many:(const struct index_node *)nodes count:(u32)n result:(struct tnt_object **)objs
+{
+	u32 ord[32];
+	for (u32 b = 0; b < n; b += nelem(ord)) {
+		u32 m = n - b < nelem(ord) ? n - b : nelem(ord);
+		const void *base = (void *)nodes + b * node_size;
+		for (u32 i = 0; i < m; i++) {
+			u32 j = i;
+			for (; j > 0; j--) {
+				if (compare(base + ord[j - 1] * node_size, base + i * node_size, dtor_arg) <= 0)
+					break;
+				ord[j] = ord[j - 1];
+			}
+			ord[j] = i;
+		}
+		for (u32 i = 0; i < m; i++)
+			objs[b + ord[i]] = [self find_node:base + ord[i] * node_size];
+	}
+}
+
 - (void)
 replace:(struct tnt_object *)obj
 {
@@ -247,6 +271,39 @@ sort_nodes:(void *)nodes_ count:(size_t)count onduplicate:(ixsort_on_duplicate)o
 
 	return no_dups;
 }
+
+- (void)
+bulk_add:(struct tnt_object *)obj
+{
+	if (bulk_count == bulk_size) {
+		bulk_size = bulk_size ? bulk_size * 2 : 1024;
+		bulk_nodes = xrealloc(bulk_nodes, bulk_size * node_size);
+	}
+	dtor(obj, bulk_nodes + bulk_count * node_size, dtor_arg);
+	bulk_count++;
+}
+
+- (bool)
+bulk_sort
+{
+	return [self sort_nodes:bulk_nodes count:bulk_count onduplicate:NULL arg:NULL];
+}
+
+- (void)
+bulk_commit
+{
+	void *nodes = bulk_nodes;
+	size_t count = bulk_count;
+
+	bulk_nodes = NULL;
+	bulk_count = bulk_size = 0;
+	if (count == 0) {
+		free(nodes);
+		return;
+	}
+	/* nodes are owned by the tree from now on */
+	[self set_sorted_nodes:nodes count:count];
+}
 @end
 
 register_source()
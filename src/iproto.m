@@ -40,12 +40,24 @@
 
 #import <cfg/defs.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#if defined(THREADS) && HAVE_SYS_EPOLL_H && HAVE_EVENTFD && CFG_iproto_io_threads
+#define IPROTO_IO_THREADS 1
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#endif
 
 #define STAT(_) \
         _(IPROTO_WORKER_STARVATION, 1)			\
@@ -54,7 +66,12 @@
 	_(IPROTO_CONNECTED, 4)                          \
 	_(IPROTO_DISCONNECTED, 5)                       \
 	_(IPROTO_WRITTEN, 6)                            \
-	_(IPROTO_READ, 7)
+	_(IPROTO_READ, 7)				\
+	_(IPROTO_FLUSH_SUBMITTED, 8)			\
+	_(IPROTO_FLUSH_SYSCALLS_SAVED, 9)		\
+	_(IPROTO_WORKER_QUEUED, 10)			\
+	_(IPROTO_WORKER_QUEUE_WAIT, 11)			\
+	_(IPROTO_WORKER_SPAWNED, 12)
 
 enum iproto_stat ENUM_INITIALIZER(STAT);
 static char const * const stat_ops[] = ENUM_STR_INITIALIZER(STAT);
@@ -65,8 +82,156 @@ struct worker_arg {
 	struct iproto_handler *ih;
 	struct iproto *r;
 	struct iproto_ingress_svc *io;
+	u64 trace;
+};
+
+/* blocking request queued by local() while all workers are busy */
+struct iproto_pending {
+	STAILQ_ENTRY(iproto_pending) link;
+	struct iproto_handler *ih;
+	struct iproto_ingress_svc *io;
+	ev_tstamp queued_at;
+	struct iproto *r;
+	u64 trace;
 };
 
+/* Request tracing: every Nth request of a service is sampled when it is
+   dispatched, the decision travels with the request to the worker. Stamps go into the process wide ring, stage
+   latencies (in microseconds) are aggregated per msg_code into
+   "iproto_trace" stat base. */
+#define TRACE_RING_SIZE 65536
+static struct iproto_trace_rec *trace_ring;
+static u32 trace_ring_pos;
+static int trace_stat_base;
+static const char *const trace_stage_name[] = {
+	[IPROTO_TRACE_READ] = "read",
+	[IPROTO_TRACE_CLASSIFY] = "classify",
+	[IPROTO_TRACE_QUEUED] = "queued",
+	[IPROTO_TRACE_CB_START] = "cb_start",
+	[IPROTO_TRACE_CB_DONE] = "cb_done",
+	[IPROTO_TRACE_WAL_SUBMIT] = "wal_submit",
+	[IPROTO_TRACE_WAL_DONE] = "wal_done",
+	[IPROTO_TRACE_WRITE] = "write"
+};
+
+static inline u64
+trace_key(struct iproto_service *service, const struct iproto *msg)
+{
+#if CFG_iproto_trace_sample
+	u32 n = cfg.iproto_trace_sample;
+	if (likely(n == 0) || ++service->trace_seq % n != 0)
+		return 0;
+	return 1ULL << 63 | (u64)msg->shard_id << 48 | (u64)msg->msg_code << 32 | msg->sync;
+#else
+	(void)service;
+	(void)msg;
+	return 0;
+#endif
+}
+
+static void trace_fiber(enum iproto_trace_stage stage);
+
+static void
+trace_stamp(u64 key, enum iproto_trace_stage stage, ev_tstamp ts)
+{
+	if (trace_ring == NULL) {
+		trace_ring = xcalloc(TRACE_RING_SIZE, sizeof(*trace_ring));
+		fiber_trace_hook = trace_fiber;
+	}
+	trace_ring[trace_ring_pos++ % TRACE_RING_SIZE] = (struct iproto_trace_rec){
+		.ts = ts,
+		.sync = key,
+		.msg_code = key >> 32,
+		.shard_id = (key >> 48) & 0x7fff,
+		.fid = fiber->fid,
+		.stage = stage
+	};
+}
+
+/* stage latency: time spent before reaching the stage */
+static void
+trace_latency(u64 key, enum iproto_trace_stage stage, ev_tstamp dt)
+{
+	char name[48];
+	int len = snprintf(name, sizeof(name), "op_%u_%s_us",
+			   (unsigned)(u16)(key >> 32), trace_stage_name[stage]);
+	stat_aggregate_named(trace_stat_base, name, len, dt * 1e6);
+}
+
+/* fiber_trace_hook: stages stamped outside of iproto, e.g. by WAL writer */
+static void
+trace_fiber(enum iproto_trace_stage stage)
+{
+	ev_tstamp now = ev_time();
+	trace_stamp(fiber->trace, stage, now);
+	if (stage == IPROTO_TRACE_WAL_DONE)
+		trace_latency(fiber->trace, stage, now - fiber->trace_ts);
+	fiber->trace_ts = now;
+}
+
+void
+iproto_trace_info(struct tbuf *out)
+{
+	u32 count = MIN(trace_ring_pos, 64);
+	tbuf_printf(out, "trace:" CRLF);
+#if CFG_iproto_trace_sample
+	tbuf_printf(out, "  sample: %i" CRLF, cfg.iproto_trace_sample);
+#endif
+	tbuf_printf(out, "  records: %u" CRLF, trace_ring_pos);
+	if (count > 0)
+		tbuf_printf(out, "  last:" CRLF);
+	for (u32 i = trace_ring_pos - count; i != trace_ring_pos; i++) {
+		struct iproto_trace_rec *r = &trace_ring[i % TRACE_RING_SIZE];
+		tbuf_printf(out, "    - { ts: %.6f, fid: %u, shard: %u, op: %u, sync: %u, stage: %s }" CRLF,
+			    r->ts, r->fid, r->shard_id, r->msg_code, r->sync,
+			    trace_stage_name[r->stage]);
+	}
+}
+
+/* binary dump: "IPTRACE1", u32 record size, u32 count, records oldest first */
+int
+iproto_trace_save(const char *filename)
+{
+	u32 count = MIN(trace_ring_pos, TRACE_RING_SIZE);
+	u32 rec_size = sizeof(struct iproto_trace_rec);
+	FILE *f = fopen(filename, "w");
+	if (f == NULL)
+		return -1;
+	fwrite("IPTRACE1", 8, 1, f);
+	fwrite(&rec_size, sizeof(rec_size), 1, f);
+	fwrite(&count, sizeof(count), 1, f);
+	for (u32 i = trace_ring_pos - count; i != trace_ring_pos; i++)
+		fwrite(&trace_ring[i % TRACE_RING_SIZE], rec_size, 1, f);
+	if (ferror(f)) {
+		int saved_errno = errno;
+		fclose(f);
+		errno = saved_errno;
+		return -1;
+	}
+	return fclose(f);
+}
+
+/* request leaves classify(): it has waited in rbuf since io->read_ts */
+static void
+trace_dispatch(struct iproto_ingress_svc *io, u64 key)
+{
+	ev_tstamp now = ev_time();
+	trace_stamp(key, IPROTO_TRACE_READ, io->read_ts);
+	trace_stamp(key, IPROTO_TRACE_CLASSIFY, now);
+	trace_latency(key, IPROTO_TRACE_CLASSIFY, now - io->read_ts);
+}
+
+static void
+trace_written(struct iproto_ingress_svc *io)
+{
+	if (likely(io->trace_write == 0))
+		return;
+	ev_tstamp now = ev_time();
+	trace_stamp(io->trace_write, IPROTO_TRACE_WRITE, now);
+	trace_latency(io->trace_write, IPROTO_TRACE_WRITE, now - io->trace_write_ts);
+	io->trace_write = 0;
+}
+
 static int
 exc_rc(Error *e)
 {
@@ -99,20 +264,119 @@ struct iproto *iproto_rbuf_req(struct netmsg_io *io)
 	return msg;
 }
 
+static int
+rbuf_count_req(struct netmsg_io *io, int limit)
+{
+	char *ptr = io->rbuf.ptr;
+	int len = rbuf_len(io), n = 0;
+	while (n < limit && len >= sizeof(struct iproto)) {
+		struct iproto *msg = (struct iproto *)ptr;
+		int size = sizeof(*msg) + msg->data_len;
+		if (len < size)
+			break;
+		ptr += size;
+		len -= size;
+		n++;
+	}
+	return n;
+}
+
+/* bounded admission queue: don't read from a client which already
+   has iproto_client_queue complete requests waiting for dispatch */
+static int
+ingress_queue_full(struct iproto_ingress_svc *io)
+{
+#if CFG_iproto_client_queue
+	return cfg.iproto_client_queue > 0 &&
+		rbuf_count_req(io, cfg.iproto_client_queue) >= cfg.iproto_client_queue;
+#else
+	(void)io;
+	return 0;
+#endif
+}
+
+/* connections served by I/O threads are read and written by the thread,
+   io_uring connections have no ev watchers */
+static void
+ingress_input_start(struct iproto_ingress_svc *io)
+{
+	if (io->io_conn != NULL)
+		return;
+	if (io->flags & NETMSG_IO_URING)
+		netmsg_uring_recv_start(io);
+	else
+		ev_io_start(&io->in);
+}
+
+static void
+ingress_input_stop(struct iproto_ingress_svc *io)
+{
+	if (io->io_conn != NULL)
+		return;
+	if (io->flags & NETMSG_IO_URING)
+		netmsg_uring_recv_stop(io);
+	else
+		ev_io_stop(&io->in);
+}
+
+static void
+ingress_output_start(struct iproto_ingress_svc *io)
+{
+	if (io->io_conn == NULL && (io->flags & (NETMSG_IO_URING | NETMSG_IO_URING_WRITE)) == 0)
+		ev_io_start(&io->out);
+}
+
 void
 iproto_worker(va_list ap)
 {
 	struct iproto_service *service = va_arg(ap, typeof(service));
+	struct iproto_pending *p;
 	struct worker_arg a;
+	ev_tstamp queued_at, trace_start = 0;
 
+	service->worker_cnt++;
 	for (;;) {
-		SLIST_INSERT_HEAD(&service->workers, fiber, worker_link);
+		/* drain the queue before becoming idle: requests are served in FIFO order */
+		if ((p = STAILQ_FIRST(&service->pending)) != NULL) {
+			STAILQ_REMOVE_HEAD(&service->pending, link);
+			service->pending_cnt--;
+			stat_collect_double(stat_base, IPROTO_WORKER_QUEUE_WAIT, ev_now() - p->queued_at);
+			a = (struct worker_arg){ p->ih, p->r, p->io, p->trace };
+			if (a.io->fd < 0) { /* client gone, nobody waits for reply */
+				a.io->inflight--;
+				netmsg_io_release(a.io);
+				free(p);
+				continue;
+			}
+		} else {
+			SLIST_INSERT_HEAD(&service->workers, fiber, worker_link);
+			service->worker_idle++;
 
-		memcpy(&a, yield(), sizeof(a));
+			void *arg = yield();
+			if (arg == NULL) { /* retired by iproto_worker_adjust() */
+				service->worker_cnt--;
+				return;
+			}
+			memcpy(&a, arg, sizeof(a));
+		}
 		size_t req_size = sizeof(struct iproto) + a.r->data_len;
 		a.r = memcpy(palloc(fiber->pool, req_size), a.r, req_size);
 		fiber->ushard = a.r->shard_id;
 		netmsg_io_retain(a.io);
+		queued_at = 0;
+		if (p != NULL) {
+			queued_at = p->queued_at;
+			netmsg_io_release(a.io); /* reference taken by local() */
+			free(p);
+		}
+
+		fiber->trace = a.trace;
+		if (unlikely(fiber->trace)) {
+			trace_start = fiber->trace_ts = ev_time();
+			if (queued_at > 0)
+				trace_latency(fiber->trace, IPROTO_TRACE_QUEUED, trace_start - queued_at);
+			trace_stamp(fiber->trace, IPROTO_TRACE_CB_START, trace_start);
+		}
 
 		struct rwlock *lock = &(shard_rt + a.r->shard_id)->lock;
 		if ((a.ih->flags & IPROTO_WLOCK) == 0)
@@ -136,10 +400,19 @@ iproto_worker(va_list ap)
 		if (ev_time() - start > cfg.warn_cb_time)
 			say_warn("too long IPROTO:%i %.3f sec", a.r->msg_code, ev_now() - start);
 #endif
+		if (unlikely(fiber->trace)) {
+			ev_tstamp now = ev_time();
+			trace_stamp(fiber->trace, IPROTO_TRACE_CB_DONE, now);
+			trace_latency(fiber->trace, IPROTO_TRACE_CB_DONE, now - trace_start);
+			a.io->trace_write = fiber->trace;
+			a.io->trace_write_ts = now;
+			fiber->trace = 0;
+		}
+		a.io->inflight--;
 
 		if (a.io->fd >= 0 && a.io->prepare_link.le_prev == NULL) {
 			LIST_INSERT_HEAD(&service->prepare, a.io, prepare_link);
-			ev_io_start(&a.io->out);
+			ingress_output_start(a.io);
 		}
 
 		if ((a.ih->flags & IPROTO_WLOCK) == 0)
@@ -182,6 +455,12 @@ packet_ready:(struct iproto *)msg
 	(void)msg;
 }
 
+- (void)
+reply_ready
+{
+	ev_io_start(&out);
+}
+
 - (void)
 data_ready
 {
@@ -200,20 +479,610 @@ close
 }
 @end
 
+#if IPROTO_IO_THREADS
+/*
+ * Network I/O threads (iproto_io_threads).
+ *
+ * Every thread owns a SO_REUSEPORT listener and the sockets accepted by it.
+ * It receives data, cuts it at request boundary and passes batches of complete
+ * requests to the main thread, where they are classified and executed exactly
+ * like requests read by the event loop. Replies are flattened by the main
+ * thread and written back by the owner thread.
+ *
+ * I/O threads never touch objc objects, palloc pools or the event loop.
+ * Both directions use iproto_io_queue: producers push with CAS, consumer
+ * takes the whole list at once, so ownership of a message is always clear.
+ */
+
+enum iproto_io_msg_type {
+	IO_CONNECT, IO_DATA, IO_EOF, IO_CLOSED, IO_DRAINED, /* I/O thread -> main */
+	IO_OUT, IO_RESUME, IO_CLOSE		/* main -> I/O thread */
+};
+
+struct iproto_io_msg {
+	struct iproto_io_msg *next;
+	struct iproto_io_conn *conn;
+	enum iproto_io_msg_type type;
+	u32 len, off, size;
+	char data[];
+};
+
+struct iproto_io_queue {
+	struct iproto_io_msg *head;
+	int efd;
+};
+
+struct iproto_io_conn {
+	int fd, events;
+	bool eof, on_paused;
+	struct iproto_io_thread *thread;
+	struct iproto_ingress_svc *ingress; /* main thread only */
+
+	/* owner thread only */
+	struct iproto_io_msg *in, *out_first, *out_last;
+	size_t out_bytes;
+	TAILQ_ENTRY(iproto_io_conn) paused_link;
+
+	int paused;   /* set by the main thread: input buffer is full */
+	int inflight; /* received, but not yet picked up by the main thread */
+	size_t unsent; /* passed to the owner thread, but not yet written */
+	int drain_wanted; /* set by the main thread: report unsent dropping
+			     below output_low_watermark, cursors are waiting */
+};
+
+struct iproto_io_thread {
+	pthread_t thread;
+	int n, epfd, listen_fd;
+	ev_tstamp accept_resume;
+	struct iproto_io *io;
+	struct iproto_io_queue outbox;
+	TAILQ_HEAD(, iproto_io_conn) paused;
+};
+
+struct iproto_io {
+	struct iproto_service *service;
+	struct sockaddr_storage saddr;
+	struct iproto_io_queue inbox;
+	ev_io inbox_ev;
+	int count;
+	struct iproto_io_thread thread[];
+};
+
+static void
+io_queue_init(struct iproto_io_queue *q)
+{
+	q->head = NULL;
+	q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q->efd < 0)
+		panic_syserror("eventfd");
+}
+
+static void
+io_queue_push(struct iproto_io_queue *q, struct iproto_io_msg *m)
+{
+	struct iproto_io_msg *head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	do
+		m->next = head;
+	while (!__atomic_compare_exchange_n(&q->head, &head, m, true,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* consumer takes everything at once: wake it only on first message */
+	if (head == NULL) {
+		u64 v = 1;
+		while (write(q->efd, &v, sizeof(v)) < 0 && errno == EINTR);
+	}
+}
+
+/* returns pushed messages in FIFO order */
+static struct iproto_io_msg *
+io_queue_take(struct iproto_io_queue *q)
+{
+	u64 v;
+	while (read(q->efd, &v, sizeof(v)) < 0 && errno == EINTR);
+
+	struct iproto_io_msg *m = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE),
+			     *fifo = NULL, *next;
+	for (; m; m = next) {
+		next = m->next;
+		m->next = fifo;
+		fifo = m;
+	}
+	return fifo;
+}
+
+static struct iproto_io_msg *
+io_msg_alloc(struct iproto_io_conn *c, enum iproto_io_msg_type type, u32 size)
+{
+	struct iproto_io_msg *m = xmalloc(sizeof(*m) + size);
+	m->next = NULL;
+	m->conn = c;
+	m->type = type;
+	m->len = m->off = 0;
+	m->size = size;
+	return m;
+}
+
+static void
+io_conn_update(struct iproto_io_thread *t, struct iproto_io_conn *c)
+{
+	bool pause = __atomic_load_n(&c->paused, __ATOMIC_RELAXED) ||
+		     __atomic_load_n(&c->inflight, __ATOMIC_RELAXED) > cfg.input_high_watermark ||
+		     c->out_bytes >= cfg.output_high_watermark;
+	int events = (pause ? 0 : EPOLLIN) | (c->out_first ? EPOLLOUT : 0);
+
+	if (pause && !c->on_paused)
+		TAILQ_INSERT_TAIL(&t->paused, c, paused_link);
+	else if (!pause && c->on_paused)
+		TAILQ_REMOVE(&t->paused, c, paused_link);
+	c->on_paused = pause;
+
+	if (events != c->events) {
+		struct epoll_event ev = { .events = events, .data.ptr = c };
+		if (epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+			say_syserror("epoll_ctl");
+		c->events = events;
+	}
+}
+
+static void
+io_conn_detach(struct iproto_io_thread *t, struct iproto_io_conn *c)
+{
+	if (c->eof)
+		return;
+	c->eof = true;
+	if (epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL) < 0)
+		say_syserror("epoll_ctl");
+	if (c->on_paused)
+		TAILQ_REMOVE(&t->paused, c, paused_link);
+	c->on_paused = false;
+}
+
+static void
+io_conn_eof(struct iproto_io_thread *t, struct iproto_io_conn *c)
+{
+	if (c->eof)
+		return;
+	io_conn_detach(t, c);
+	io_queue_push(&t->io->inbox, io_msg_alloc(c, IO_EOF, 0));
+}
+
+static void
+io_conn_read(struct iproto_io_thread *t, struct iproto_io_conn *c)
+{
+	const int bufsize = MAX(cfg.input_buffer_size, 4096);
+	struct iproto_io_msg *m = c->in;
+	if (m == NULL) {
+		m = c->in = io_msg_alloc(c, IO_DATA, bufsize);
+	} else if (m->size - m->len < bufsize / 2) {
+		m = c->in = xrealloc(m, sizeof(*m) + m->size * 2);
+		m->size *= 2;
+	}
+
+	ssize_t r = recv(c->fd, m->data + m->len, m->size - m->len, 0);
+	if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (r <= 0) {
+		if (r < 0)
+			say_syswarn("recv(%i) failed", c->fd);
+		io_conn_eof(t, c);
+		return;
+	}
+	m->len += r;
+
+	u32 complete = 0;
+	while (m->len - complete >= sizeof(struct iproto)) {
+		struct iproto *req = (struct iproto *)(m->data + complete);
+		if (m->len - complete < sizeof(*req) + req->data_len)
+			break;
+		complete += sizeof(*req) + req->data_len;
+	}
+	if (complete == 0)
+		return;
+
+	/* incomplete tail waits for the next recv() */
+	c->in = NULL;
+	if (m->len > complete) {
+		u32 tail = m->len - complete;
+		c->in = io_msg_alloc(c, IO_DATA, MAX(bufsize, (int)tail * 2));
+		memcpy(c->in->data, m->data + complete, tail);
+		c->in->len = tail;
+	}
+	m->len = complete;
+	__atomic_add_fetch(&c->inflight, complete, __ATOMIC_RELAXED);
+	io_queue_push(&t->io->inbox, m);
+}
+
+static void
+io_conn_write(struct iproto_io_thread *t, struct iproto_io_conn *c)
+{
+	struct iovec iov[IOV_MAX];
+	while (c->out_first) {
+		int n = 0;
+		for (struct iproto_io_msg *m = c->out_first; m && n < nelem(iov); m = m->next, n++)
+			iov[n] = (struct iovec){ m->data + m->off, m->len - m->off };
+
+		ssize_t r = writev(c->fd, iov, n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			say_syswarn("writev(%i) failed", c->fd);
+			io_conn_eof(t, c);
+			return;
+		}
+
+		c->out_bytes -= r;
+		__atomic_sub_fetch(&c->unsent, r, __ATOMIC_SEQ_CST);
+		while (r > 0) {
+			struct iproto_io_msg *m = c->out_first;
+			if (r < m->len - m->off) {
+				m->off += r;
+				break;
+			}
+			r -= m->len - m->off;
+			c->out_first = m->next;
+			free(m);
+		}
+	}
+	if (c->out_first == NULL)
+		c->out_last = NULL;
+
+	/* pairs with service_prepare_io(): either it sees unsent dropped
+	   or we see drain_wanted */
+	if (__atomic_load_n(&c->unsent, __ATOMIC_SEQ_CST) < cfg.output_low_watermark &&
+	    __atomic_exchange_n(&c->drain_wanted, 0, __ATOMIC_SEQ_CST))
+		io_queue_push(&t->io->inbox, io_msg_alloc(c, IO_DRAINED, 0));
+}
+
+static void
+io_conn_free_buffers(struct iproto_io_conn *c)
+{
+	struct iproto_io_msg *m, *next;
+	for (m = c->out_first; m; m = next) {
+		next = m->next;
+		free(m);
+	}
+	c->out_first = c->out_last = NULL;
+	c->out_bytes = 0;
+	free(c->in);
+	c->in = NULL;
+}
+
+static void
+io_accept(struct iproto_io_thread *t)
+{
+	int fd, one = 1;
+	while ((fd = accept(t->listen_fd, NULL, NULL)) >= 0) {
+		if (ioctl(fd, FIONBIO, &one) < 0 ||
+		    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+		{
+			say_syserror("ioctl/setsockopt");
+			close(fd);
+			continue;
+		}
+
+		struct iproto_io_conn *c = xcalloc(1, sizeof(*c));
+		c->fd = fd;
+		c->thread = t;
+		c->events = EPOLLIN;
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			say_syserror("epoll_ctl");
+			close(fd);
+			free(c);
+			continue;
+		}
+		io_queue_push(&t->io->inbox, io_msg_alloc(c, IO_CONNECT, 0));
+	}
+
+	if (errno == EMFILE || errno == ENFILE) {
+		say_error("can't accept, too many open files, throttling");
+		struct epoll_event ev = { .events = 0, .data.ptr = NULL };
+		epoll_ctl(t->epfd, EPOLL_CTL_MOD, t->listen_fd, &ev);
+		t->accept_resume = ev_time() + 0.5;
+	} else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+		   errno != ECONNABORTED) {
+		say_syserror("accept");
+	}
+}
+
+/* connections are freed by the main thread after IO_CLOSED, so it must be
+   sent only when no stale epoll event may refer to them */
+static struct iproto_io_msg *
+io_outbox(struct iproto_io_thread *t, struct iproto_io_msg *closed)
+{
+	struct iproto_io_msg *m = io_queue_take(&t->outbox), *next;
+	for (; m; m = next) {
+		next = m->next;
+		struct iproto_io_conn *c = m->conn;
+		switch (m->type) {
+		case IO_OUT:
+			if (c->eof) {
+				free(m);
+				break;
+			}
+			m->next = NULL;
+			if (c->out_last)
+				c->out_last->next = m;
+			else
+				c->out_first = m;
+			c->out_last = m;
+			c->out_bytes += m->len;
+			io_conn_write(t, c);
+			if (!c->eof)
+				io_conn_update(t, c);
+			break;
+		case IO_RESUME:
+			if (!c->eof)
+				io_conn_update(t, c);
+			free(m);
+			break;
+		case IO_CLOSE:
+			io_conn_detach(t, c);
+			if (close(c->fd) < 0)
+				say_syswarn("close");
+			io_conn_free_buffers(c);
+			m->type = IO_CLOSED;
+			m->next = closed;
+			closed = m;
+			break;
+		default:
+			abort();
+		}
+	}
+	return closed;
+}
+
+static void *
+iproto_io_loop(void *arg)
+{
+	struct iproto_io_thread *t = arg;
+	struct epoll_event ev[64];
+	char name[32];
+
+	snprintf(name, sizeof(name), "iproto/io%i", t->n);
+	fiber_create_fake(name);
+
+	for (;;) {
+		int timeout = -1;
+		if (!TAILQ_EMPTY(&t->paused))
+			timeout = 1;
+		else if (t->accept_resume > 0)
+			timeout = 100;
+
+		int n = epoll_wait(t->epfd, ev, nelem(ev), timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			panic_syserror("epoll_wait");
+		}
+
+		struct iproto_io_msg *closed = NULL, *next;
+		for (int i = 0; i < n; i++) {
+			if (ev[i].data.ptr == NULL) {
+				io_accept(t);
+			} else if (ev[i].data.ptr == t) {
+				closed = io_outbox(t, closed);
+			} else {
+				struct iproto_io_conn *c = ev[i].data.ptr;
+				if (!c->eof && ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+					io_conn_read(t, c);
+				if (!c->eof && ev[i].events & EPOLLOUT)
+					io_conn_write(t, c);
+				if (!c->eof)
+					io_conn_update(t, c);
+			}
+		}
+
+		struct iproto_io_conn *c, *tmp;
+		TAILQ_FOREACH_SAFE(c, &t->paused, paused_link, tmp)
+			io_conn_update(t, c);
+
+		if (t->accept_resume > 0 && ev_time() > t->accept_resume) {
+			struct epoll_event lev = { .events = EPOLLIN, .data.ptr = NULL };
+			epoll_ctl(t->epfd, EPOLL_CTL_MOD, t->listen_fd, &lev);
+			t->accept_resume = 0;
+		}
+
+		for (; closed; closed = next) {
+			next = closed->next;
+			io_queue_push(&t->io->inbox, closed);
+		}
+	}
+	return NULL;
+}
+
+static void
+iproto_io_inbox(struct iproto_io *io)
+{
+	struct iproto_service *service = io->service;
+	struct iproto_io_msg *m = io_queue_take(&io->inbox), *next;
+
+	for (; m; m = next) {
+		next = m->next;
+		struct iproto_io_conn *c = m->conn;
+		switch (m->type) {
+		case IO_CONNECT:
+			c->ingress = [service->ingress_class alloc];
+			c->ingress->io_conn = c;
+			[c->ingress init:c->fd service:service];
+			break;
+		case IO_DATA:
+			__atomic_sub_fetch(&c->inflight, m->len, __ATOMIC_RELAXED);
+			if (c->ingress == nil)
+				break;
+			stat_sum_static(stat_base, IPROTO_READ, m->len);
+			rbuf_append(c->ingress, m->data, m->len);
+			[c->ingress data_ready];
+			break;
+		case IO_EOF:
+			if (c->ingress != nil) {
+				say_debug("peer %s [%i] closed connection", net_fd_name(c->fd), c->fd);
+				[c->ingress close];
+			}
+			break;
+		case IO_CLOSED:
+			free(c);
+			break;
+		case IO_DRAINED:
+			if (c->ingress != nil && !TAILQ_EMPTY(&c->ingress->cursors) &&
+			    c->ingress->prepare_link.le_prev == NULL)
+				LIST_INSERT_HEAD(&service->prepare, c->ingress, prepare_link);
+			break;
+		default:
+			abort();
+		}
+		free(m);
+	}
+}
+
+static void
+iproto_io_send(struct iproto_io_conn *c, enum iproto_io_msg_type type)
+{
+	io_queue_push(&c->thread->outbox, io_msg_alloc(c, type, 0));
+}
+
+static void
+iproto_io_close(struct iproto_io_conn *c)
+{
+	c->ingress = nil;
+	iproto_io_send(c, IO_CLOSE);
+}
+
+/* called instead of writev() for connections served by an I/O thread */
+static void
+iproto_io_prepare(struct iproto_ingress_svc *io)
+{
+	struct iproto_io_conn *c = io->io_conn;
+	int paused = (rbuf_len(io) >= cfg.input_low_watermark && iproto_rbuf_req(io)) ||
+		     ingress_queue_full(io);
+
+	if (paused != c->paused) {
+		__atomic_store_n(&c->paused, paused, __ATOMIC_RELAXED);
+		if (!paused)
+			iproto_io_send(c, IO_RESUME);
+	}
+
+	if (io->wbuf.bytes > 0) {
+		struct iproto_io_msg *m = io_msg_alloc(c, IO_OUT, io->wbuf.bytes);
+		m->len = io->wbuf.bytes;
+		netmsg_flatten(&io->wbuf, m->data);
+		__atomic_add_fetch(&c->unsent, m->len, __ATOMIC_SEQ_CST);
+		stat_sum_static(stat_base, IPROTO_WRITTEN, m->len);
+		io_queue_push(&c->thread->outbox, m);
+	}
+}
+
+static struct iproto_io *
+iproto_io_init(struct iproto_service *service, const char *addr)
+{
+	struct sockaddr_storage saddr;
+	if (atosaddr(addr, (struct sockaddr *)&saddr) < 0)
+		return NULL;
+	if (((struct sockaddr *)&saddr)->sa_family != AF_INET) {
+		say_warn("%s: iproto_io_threads are supported only for TCP addresses",
+			 service->name);
+		return NULL;
+	}
+
+	int count = cfg.iproto_io_threads;
+	struct iproto_io *io = xcalloc(1, sizeof(*io) + count * sizeof(io->thread[0]));
+	io->service = service;
+	io->saddr = saddr;
+	io->count = count;
+	io_queue_init(&io->inbox);
+	return io;
+}
+
+static void
+iproto_io_acceptor(va_list ap)
+{
+	struct iproto_service *service = va_arg(ap, typeof(service));
+	struct iproto_io *io = service->io;
+
+	for (int i = 0; i < io->count; i++) {
+		struct iproto_io_thread *t = &io->thread[i];
+		t->listen_fd = server_socket(SOCK_STREAM, (struct sockaddr *)&io->saddr,
+					     SERVER_SOCKET_NONBLOCK | SERVER_SOCKET_REUSEPORT,
+					     i == 0 ? service->on_bind : NULL, fiber_sleep);
+		if (t->listen_fd < 0)
+			panic("unable to start iproto_service `%s'", service->addr);
+	}
+
+	for (int i = 0; i < io->count; i++) {
+		struct iproto_io_thread *t = &io->thread[i];
+		t->n = i;
+		t->io = io;
+		TAILQ_INIT(&t->paused);
+		io_queue_init(&t->outbox);
+
+		t->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (t->epfd < 0)
+			panic_syserror("epoll_create1");
+		struct epoll_event lev = { .events = EPOLLIN, .data.ptr = NULL },
+				   qev = { .events = EPOLLIN, .data.ptr = t };
+		if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->listen_fd, &lev) < 0 ||
+		    epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->outbox.efd, &qev) < 0)
+			panic_syserror("epoll_ctl");
+
+		int err = pthread_create(&t->thread, NULL, iproto_io_loop, t);
+		if (err != 0) {
+			errno = err;
+			panic_syserror("pthread_create");
+		}
+	}
+	say_info("%s: %i I/O threads", service->name, io->count);
+
+	io->inbox_ev = (ev_io){ .coro = 1 };
+	ev_io_init(&io->inbox_ev, (void *)fiber, io->inbox.efd, EV_READ);
+	ev_io_start(&io->inbox_ev);
+	for (;;) {
+		yield();
+		iproto_io_inbox(io);
+		fiber_gc();
+	}
+}
+#endif
+
 static int ingress_cnt = 0;
+static SLIST_HEAD(, iproto_service) services = SLIST_HEAD_INITIALIZER(services);
 static void
 report_ingress_cnt(int base _unused_)
 {
+	struct iproto_service *s;
+	int busy = 0, idle = 0, queued = 0;
+	SLIST_FOREACH(s, &services, link) {
+		busy += s->worker_cnt - s->worker_idle;
+		idle += s->worker_idle;
+		queued += s->pending_cnt;
+	}
 	stat_report_gauge("IPROTO_CLIENTS", sizeof("IPROTO_CLIENTS"), ingress_cnt);
+	stat_report_gauge("IPROTO_WORKERS_BUSY", sizeof("IPROTO_WORKERS_BUSY"), busy);
+	stat_report_gauge("IPROTO_WORKERS_IDLE", sizeof("IPROTO_WORKERS_IDLE"), idle);
+	stat_report_gauge("IPROTO_WORKER_QUEUE", sizeof("IPROTO_WORKER_QUEUE"), queued);
 }
 
 @implementation iproto_ingress_svc
+/* same path as worker replies: socket may be owned by I/O thread or io_uring */
+- (void)
+reply_ready
+{
+	if (fd >= 0 && prepare_link.le_prev == NULL) {
+		LIST_INSERT_HEAD(&service->prepare, self, prepare_link);
+		ingress_output_start(self);
+	}
+}
+
 - (void)
 data_ready
 {
 	/* client->service->processing will be traversed by wakeup_workers() */
-	if (processing_link.tqe_prev == NULL)
+	read_ts = ev_now();
+	if (processing_link.tqe_prev == NULL) {
 		TAILQ_INSERT_TAIL(&service->processing, self, processing_link);
+		pending_since = ev_now();
+	}
 }
 
 - (void)
@@ -229,11 +1098,35 @@ close
 		LIST_REMOVE(self, prepare_link);
 		prepare_link.le_prev = NULL;
 	}
+#if IPROTO_IO_THREADS
+	if (io_conn != NULL) {
+		/* socket is owned and will be closed by the I/O thread */
+		iproto_io_close(io_conn);
+		io_conn = NULL;
+		fd = -1;
+	}
+#endif
 	LIST_REMOVE(self, link);
 	[super close];
 	netmsg_io_release(self);
 }
 
+/* value of key in "key=value,..." list of iproto_peer_weight
+   and iproto_request_cost options */
+static int
+cfg_list_value(const char *list, const char *key, int def)
+{
+	size_t len = strlen(key);
+	for (const char *p = list; p != NULL && *p; ) {
+		p += strspn(p, ", ");
+		const char *end = p + strcspn(p, ", "), *eq = memchr(p, '=', end - p);
+		if (eq != NULL && (size_t)(eq - p) == len && memcmp(p, key, len) == 0)
+			return atoi(eq + 1);
+		p = end;
+	}
+	return def;
+}
+
 static void
 iproto_service_svc_read_cb(ev_io *ev, int events)
 {
@@ -251,11 +1144,14 @@ iproto_service_svc_write_cb(ev_io *ev, int events)
 	ssize_t r = netmsg_io_write_for_cb(ev, events);
 	if (r > 0)
 		stat_sum_static(stat_base, IPROTO_WRITTEN, r);
+	if (io->wbuf.bytes == 0)
+		trace_written((struct iproto_ingress_svc *)io);
 
 	if (io->fd >= 0 &&
             ((rbuf_len(io) < cfg.input_low_watermark) || !iproto_rbuf_req(io) ) &&
-	    io->wbuf.bytes < cfg.output_low_watermark)
-		ev_io_start(&io->in);
+	    io->wbuf.bytes < cfg.output_low_watermark &&
+	    !ingress_queue_full((struct iproto_ingress_svc *)io))
+		ingress_input_start((struct iproto_ingress_svc *)io);
 	netmsg_io_release(io);
 }
 
@@ -274,12 +1170,39 @@ init:(int)fd_ service:(struct iproto_service *)service_
 	ingress_cnt++;
 	stat_sum_static(stat_base, IPROTO_CONNECTED, 1);
 	service = service_;
+	weight = 1;
+#if CFG_iproto_peer_weight
+	struct sockaddr_in peer;
+	socklen_t peer_len = sizeof(peer);
+	char ip[INET_ADDRSTRLEN];
+	if (cfg.iproto_peer_weight != NULL &&
+	    getpeername(fd_, (struct sockaddr *)&peer, &peer_len) == 0 &&
+	    peer.sin_family == AF_INET &&
+	    inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip)) != NULL)
+		weight = MAX(cfg_list_value(cfg.iproto_peer_weight, ip, 1), 1);
+#endif
 	netmsg_io_init(self, &service->ctx, fd_);
 	ev_init(&self->in, iproto_service_svc_read_cb);
 	ev_init(&self->out, iproto_service_svc_write_cb);
 	self->flags |= NETMSG_IO_SHARED_POOL;
 	LIST_INSERT_HEAD(&service->clients, self, link);
-	ev_io_start(&in);
+	if (io_conn == NULL) {
+		if (service->options & SERVICE_IO_URING)
+			netmsg_uring_attach(self, NETMSG_IO_URING);
+		else if (service->options & SERVICE_BATCH_WRITES)
+			netmsg_uring_attach(self, NETMSG_IO_URING_WRITE);
+	}
+	ingress_input_start(self);
+}
+
+/* io_uring transport: let service_prepare_io() write the rest and resume input */
+- (void)
+uring_written:(ssize_t)r
+{
+	if (r > 0)
+		stat_sum_static(stat_base, IPROTO_WRITTEN, r);
+	if (fd >= 0 && prepare_link.le_prev == NULL)
+		LIST_INSERT_HEAD(&service->prepare, self, prepare_link);
 }
 @end
 
@@ -311,17 +1234,73 @@ iproto_service(struct iproto_service *service, const char *addr)
 	sprintf(name, "iproto:%s", addr);
 
 	TAILQ_INIT(&service->processing);
+	STAILQ_INIT(&service->pending);
+	SLIST_INSERT_HEAD(&services, service, link);
 	netmsg_pool_ctx_init(&service->ctx, name, 2 * 1024 * 1024);
+#if CFG_iproto_rbuf_chunk_size
+	if (cfg.iproto_rbuf_chunk_size > 0)
+		netmsg_pool_ctx_shared_rbuf(&service->ctx, cfg.iproto_rbuf_chunk_size);
+#endif
 	service->name = name;
 	service->batch = 32;
-	service->addr = strdup(addr);
+
+	/* addr is a comma separated list of listen addresses: host:port,
+	   /path or ./path for unix sockets and @name for abstract ones.
+	   The first TCP address is the primary one: it is served by
+	   I/O threads and used for UDP routing updates */
+	int addr_cnt = 0;
+	char *list = strdup(addr), *saveptr = NULL;
+	const char *addrs[16];
+	for (char *a = strtok_r(list, ", ", &saveptr); a; a = strtok_r(NULL, ", ", &saveptr)) {
+		if (addr_cnt == nelem(addrs))
+			panic("iproto_service `%s': too many addresses", addr);
+		addrs[addr_cnt++] = a;
+	}
+	if (addr_cnt == 0)
+		panic("iproto_service: empty address");
+	int primary = -1;
+	for (int i = 0; i < addr_cnt; i++)
+		if (addrs[i][0] != '/' && addrs[i][0] != '.' && addrs[i][0] != '@') {
+			primary = i;
+			break;
+		}
+	bool tcp = primary >= 0;
+	if (!tcp)
+		primary = 0;
+	service->addr = addrs[primary];
 
 	if (service->ingress_class == Nil)
 		service->ingress_class = [iproto_ingress_svc class];
-	service->acceptor = fiber_create("iproto/acceptor", tcp_server, addr,
+#if CFG_iproto_io_uring
+	if (cfg.iproto_io_uring)
+		service->options |= SERVICE_IO_URING;
+#endif
+#if CFG_iproto_batch_writes
+	if (cfg.iproto_batch_writes)
+		service->options |= SERVICE_BATCH_WRITES;
+#endif
+#if IPROTO_IO_THREADS
+	if (cfg.iproto_io_threads > 0 && !tcp)
+		say_info("%s: no TCP address, iproto_io_threads are not used", name);
+	if (cfg.iproto_io_threads > 0 && tcp)
+		service->io = iproto_io_init(service, service->addr);
+	if (service->io != NULL)
+		service->acceptor = fiber_create("iproto/io", iproto_io_acceptor, service);
+	else
+#endif
+	service->acceptor = fiber_create("iproto/acceptor", tcp_server, service->addr,
 					 iproto_accept_client, service->on_bind, service);
 	if (service->acceptor == NULL)
-		panic("unable to start iproto_service `%s'", addr);
+		panic("unable to start iproto_service `%s'", service->addr);
+
+	/* secondary addresses are always served by the event loop */
+	for (int i = 0; i < addr_cnt; i++) {
+		if (i == primary)
+			continue;
+		if (fiber_create("iproto/acceptor", tcp_server, addrs[i],
+				 iproto_accept_client, NULL, service) == NULL)
+			panic("unable to start iproto_service `%s'", addrs[i]);
+	}
 
 	ev_prepare_init(&service->wakeup, (void *)iproto_wakeup_workers);
 	ev_prepare_start(&service->wakeup);
@@ -372,6 +1351,22 @@ service_register_iproto(struct iproto_service *s, u32 cmd, iproto_cb cb, int fla
 			.cb = cb,
 			.flags = flags
 		});
+#if CFG_iproto_request_cost
+	char code[16];
+	snprintf(code, sizeof(code), "%u", cmd);
+	int cost = cfg_list_value(cfg.iproto_request_cost, code, 0);
+	if (cost > 0)
+		service_set_cost(s, cmd, cost);
+#endif
+}
+
+void
+service_set_cost(struct iproto_service *s, u32 cmd, int cost)
+{
+	struct iproto_handler *ih = service_find_code(s, cmd);
+	if (ih == &s->default_handler)
+		panic("%s: no handler for 0x%x", s->name, cmd);
+	ih->cost = cost;
 }
 
 static int
@@ -381,10 +1376,17 @@ local(struct iproto_ingress_svc *io, struct iproto *msg, struct iproto_handler *
 		   net_fd_name(io->fd), msg->msg_code, msg->sync,
 		   ih->flags & IPROTO_NONBLOCK ? " NONBLOCK" : "",
 		   ih->flags & IPROTO_LOCAL ? " LOCAL" : "");
+	u64 trace = trace_key(io->service, msg);
 	if (ih->flags & IPROTO_NONBLOCK) {
 		stat_collect(stat_base, IPROTO_STREAM_OP, 1);
 		struct netmsg_mark header_mark;
 		netmsg_getmark(&io->wbuf, &header_mark);
+		ev_tstamp trace_start = 0;
+		if (unlikely(trace)) {
+			trace_dispatch(io, trace);
+			trace_start = ev_time();
+			trace_stamp(trace, IPROTO_TRACE_CB_START, trace_start);
+		}
 		@try {
 			fiber->ushard = msg->shard_id;
 			ih->cb(&io->wbuf, msg);
@@ -397,20 +1399,63 @@ local(struct iproto_ingress_svc *io, struct iproto *msg, struct iproto_handler *
 		@finally {
 			fiber->ushard = -1;
 		}
+		if (unlikely(trace)) {
+			ev_tstamp now = ev_time();
+			trace_stamp(trace, IPROTO_TRACE_CB_DONE, now);
+			trace_latency(trace, IPROTO_TRACE_CB_DONE, now - trace_start);
+			io->trace_write = trace;
+			io->trace_write_ts = now;
+		}
 	} else {
 		struct iproto_service *service = io->service;
+#if CFG_iproto_client_quota
+		/* don't let a single client occupy all workers */
+		if (cfg.iproto_client_quota > 0 && io->inflight >= cfg.iproto_client_quota)
+			return 0;
+#endif
 		struct Fiber *w = SLIST_FIRST(&service->workers);
 		if (!w) {
 			stat_collect(stat_base, IPROTO_WORKER_STARVATION, 1);
+#if CFG_iproto_worker_max
+			/* keep reading: the request will be picked by the first free worker */
+			if (cfg.iproto_worker_max > 0 && service->pending_cnt < cfg.iproto_worker_queue) {
+				size_t req_size = sizeof(*msg) + msg->data_len;
+				struct iproto_pending *p = xmalloc(sizeof(*p) + req_size);
+				p->ih = ih;
+				p->io = io;
+				p->queued_at = ev_now();
+				p->r = memcpy(p + 1, msg, req_size);
+				p->trace = trace;
+				STAILQ_INSERT_TAIL(&service->pending, p, link);
+				service->pending_cnt++;
+				if (unlikely(trace)) {
+					trace_dispatch(io, trace);
+					trace_stamp(trace, IPROTO_TRACE_QUEUED, ev_time());
+				}
+				stat_collect(stat_base, IPROTO_WORKER_QUEUED, 1);
+				netmsg_io_retain(io);
+				io->inflight++;
+				goto dispatched;
+			}
+#endif
 			// FIXME: need state for this
 			return 0;
 		}
 
 		stat_collect(stat_base, IPROTO_BLOCK_OP, 1);
 		SLIST_REMOVE_HEAD(&service->workers, worker_link);
-		resume(w, (&(struct worker_arg){ih, msg, io}));
-		io->batch--;
+		service->worker_idle--;
+		io->inflight++;
+		if (unlikely(trace))
+			trace_dispatch(io, trace);
+		resume(w, (&(struct worker_arg){ih, msg, io, trace}));
 	}
+#if CFG_iproto_worker_max
+dispatched:
+#endif
+	io->wait_time += ev_now() - io->pending_since;
+	io->pending_since = ev_now();
+	io->dispatched++;
 	return 1;
 }
 
@@ -462,17 +1507,42 @@ classify(struct iproto_ingress_svc *io, struct iproto *msg)
 
 }
 
-static void
+static int
+request_cost(struct iproto_service *service, struct iproto *msg)
+{
+	if (msg->msg_code == MSG_IPROXY)
+		msg++; // unwrap
+	return service_find_code(service, msg->msg_code)->cost ?: 1;
+}
+
+/* Deficit round robin: each round a client may dispatch requests of total
+   cost up to service->batch * weight, unused quantum is carried over while
+   its next request is too expensive (cost is capped at one quantum,
+   so it runs in the next round at last). Client blocked by lack of workers or
+   by iproto_client_quota keeps at most one quantum. */
+static int
 process_requests(struct iproto_service *service, struct iproto_ingress_svc *io)
 {
-	netmsg_io_retain(io);
-	io->batch = service->batch;
+	int quantum = service->batch * io->weight;
+	int done = 0, blocked = 0;
 	struct iproto *msg;
-	while ((msg = iproto_rbuf_req(io)) && io->batch > 0) {
+
+	netmsg_io_retain(io);
+	io->deficit += quantum;
+	while ((msg = iproto_rbuf_req(io))) {
 		size_t msg_size = sizeof(*msg) + msg->data_len;
-		if (classify(io, msg) == 0)
+		/* more expensive request would never fit into deficit
+		   and stall the client */
+		int cost = MIN(request_cost(service, msg), quantum);
+		if (cost > io->deficit)
 			break;
+		if (classify(io, msg) == 0) {
+			blocked = 1;
+			break;
+		}
+		io->deficit -= cost;
 		rbuf_ltrim(io, msg_size);
+		done++;
 	}
 
 	if (unlikely(io->fd == -1)) /* handler may close connection */
@@ -481,33 +1551,74 @@ process_requests(struct iproto_service *service, struct iproto_ingress_svc *io)
 	if (!iproto_rbuf_req(io)) {
 		TAILQ_REMOVE(&service->processing, io, processing_link);
 		io->processing_link.tqe_prev = NULL;
+		io->deficit = 0;
 
 		/* input buffer is empty or has partially read oversize request */
-		ev_io_start(&io->in);
-	} else if (io->batch < service->batch) {
-		/* avoid unfair scheduling in case of absense of stream requests
-		   and all workers being busy */
+		ingress_input_start(io);
+	} else {
+		if (blocked && io->deficit > quantum)
+			io->deficit = quantum;
+		/* next round starts with the clients which didn't run yet */
 		TAILQ_REMOVE(&service->processing, io, processing_link);
 		TAILQ_INSERT_TAIL(&service->processing, io, processing_link);
 	}
 out:
 	netmsg_io_release(io);
+	return done;
 }
 
 static void
 service_prepare_io(struct iproto_ingress_svc *io)
 {
+#if IPROTO_IO_THREADS
+	if (io->io_conn != NULL) {
+		/* cursors are pulled while output queued to the I/O thread is
+		   below output_low_watermark, it asks for more once written */
+		struct iproto_io_conn *c = io->io_conn;
+		for (;;) {
+			size_t unsent = __atomic_load_n(&c->unsent, __ATOMIC_SEQ_CST);
+			if (!TAILQ_EMPTY(&io->cursors) && netmsg_io_pull(io, unsent) < 0)
+				return;
+			size_t pending = unsent + io->wbuf.bytes;
+			iproto_io_prepare(io);
+			if (TAILQ_EMPTY(&io->cursors) || pending < cfg.output_low_watermark)
+				break;
+			__atomic_store_n(&c->drain_wanted, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&c->unsent, __ATOMIC_SEQ_CST) >= cfg.output_low_watermark)
+				break;
+		}
+		trace_written(io);
+		return;
+	}
+#endif
+	size_t inflight = netmsg_uring_inflight(io);
+	if (!TAILQ_EMPTY(&io->cursors) && netmsg_io_pull(io, inflight) < 0)
+		return;
+	int queue_full = ingress_queue_full(io);
 	if (rbuf_len(io) >= cfg.input_low_watermark && iproto_rbuf_req(io)) {
 		if (ev_now() - io->input_overflow_warn > 10) {
 			say_warn("peer %s input buffer low watermark overflow (size %i)",
 				 net_fd_name(io->fd), rbuf_len(io));
 			io->input_overflow_warn = ev_now();
 		}
-		ev_io_stop(&io->in);
+		ingress_input_stop(io);
+	} else if (queue_full) {
+		ingress_input_stop(io);
 	}
 
-	if (rbuf_len(io) < cfg.input_low_watermark && io->wbuf.bytes < cfg.output_low_watermark)
-		ev_io_start(&io->in);
+	if (rbuf_len(io) < cfg.input_low_watermark &&
+	    io->wbuf.bytes + inflight < cfg.output_low_watermark && !queue_full)
+		ingress_input_start(io);
+
+	if (io->flags & (NETMSG_IO_URING | NETMSG_IO_URING_WRITE)) {
+		/* wbuf.bytes includes data being written by writev,
+		   sendmsg_zc moves it out of wbuf */
+		netmsg_uring_write(io);
+		trace_written(io);
+		if (io->wbuf.bytes + netmsg_uring_inflight(io) >= cfg.output_high_watermark)
+			ingress_input_stop(io);
+		return;
+	}
 
 #ifndef IPROTO_PESSIMISTIC_WRITES
 	if (io->wbuf.bytes > 0) {
@@ -522,6 +1633,8 @@ service_prepare_io(struct iproto_ingress_svc *io)
 		}
 	}
 #endif
+	if (io->wbuf.bytes == 0)
+		trace_written(io);
 
 	if (io->wbuf.bytes > 0) {
 		ev_io_start(&io->out);
@@ -540,23 +1653,66 @@ service_prepare_io(struct iproto_ingress_svc *io)
 	}
 }
 
+#if CFG_iproto_worker_max
+/* Elastic worker pool: a worker is spawned when the oldest queued request
+   waits longer than worker_grow_delay, an extra worker is retired every
+   worker_shrink_period if some workers stayed idle for the whole period. */
+static const ev_tstamp worker_grow_delay = 0.005, worker_shrink_period = 1.0;
+
+static void
+iproto_worker_adjust(struct iproto_service *service)
+{
+	struct iproto_pending *p = STAILQ_FIRST(&service->pending);
+	if (p != NULL && ev_now() - p->queued_at > worker_grow_delay &&
+	    service->worker_cnt < cfg.iproto_worker_max)
+	{
+		service->worker_spawned++;
+		stat_collect(stat_base, IPROTO_WORKER_SPAWNED, 1);
+		fiber_create("iproto/worker", iproto_worker, service);
+		say_debug("%s: %i workers", service->name, service->worker_cnt);
+	}
+
+	if (service->worker_idle < service->worker_idle_min)
+		service->worker_idle_min = service->worker_idle;
+	if (ev_now() - service->worker_idle_check < worker_shrink_period)
+		return;
+
+	if (service->worker_spawned > 0 && service->worker_idle_min > 0) {
+		struct Fiber *w = SLIST_FIRST(&service->workers);
+		SLIST_REMOVE_HEAD(&service->workers, worker_link);
+		service->worker_idle--;
+		service->worker_spawned--;
+		resume(w, NULL);
+	}
+	service->worker_idle_min = service->worker_idle;
+	service->worker_idle_check = ev_now();
+}
+#endif
+
 static void
 iproto_wakeup_workers(ev_prepare *ev)
 {
 	struct iproto_service *service = container_of(ev, struct iproto_service, wakeup);
 	struct iproto_ingress_svc *c, *tmp, *last;
+	int done;
 	palloc_register_cut_point(fiber->pool);
 	do {
+		done = 0;
 		last = TAILQ_LAST(&service->processing, ingress_tailq);
 		TAILQ_FOREACH_SAFE(c, &service->processing, processing_link, tmp) {
 			if (c->prepare_link.le_prev == NULL)
 				LIST_INSERT_HEAD(&service->prepare, c, prepare_link);
 
-			process_requests(service, c);
+			done += process_requests(service, c);
 			/* process_requests() may move *c to the end of tailq */
 			if (c == last) break;
 		}
-	} while (!SLIST_EMPTY(&service->workers) && !TAILQ_EMPTY(&service->processing));
+		/* stop if every pending client is waiting for a worker or its quota */
+	} while (done > 0 && !TAILQ_EMPTY(&service->processing));
+#if CFG_iproto_worker_max
+	if (cfg.iproto_worker_max > 0)
+		iproto_worker_adjust(service);
+#endif
 	netmsg_pool_ctx_gc(&service->ctx);
 	palloc_cutoff(fiber->pool);
 }
@@ -571,6 +1727,14 @@ iproto_write_data(ev_prepare *ev) {
 		c->prepare_link.le_prev = NULL;
 		service_prepare_io(c);
 	}
+	/* all io_uring writes and receives of this iteration at once */
+	int writes;
+	int n = netmsg_uring_submit(&writes);
+	if (n > 0)
+		stat_collect(stat_base, IPROTO_FLUSH_SUBMITTED, n);
+	/* one io_uring_enter instead of a write per connection */
+	if (writes > 1)
+		stat_collect(stat_base, IPROTO_FLUSH_SYSCALLS_SAVED, writes - 1);
 	assert(palloc_allocated(fiber->pool) == allocated);
 }
 
@@ -650,11 +1814,25 @@ iproto_service_info(struct tbuf *out, struct iproto_service *service)
 		struct netmsg_io *io = c;
 		tbuf_printf(out, "    - peer: %s" CRLF, net_fd_name(io->fd));
 		tbuf_printf(out, "      fd: %i" CRLF, io->fd);
-		tbuf_printf(out, "      state: %s%s" CRLF,
-			    ev_is_active(&io->in) ? "in" : "",
-			    ev_is_active(&io->out) ? "out" : "");
+		if (c->io_conn != NULL)
+			tbuf_printf(out, "      state: thread" CRLF);
+		else if (io->flags & NETMSG_IO_URING)
+			tbuf_printf(out, "      state: uring" CRLF);
+		else if (io->flags & NETMSG_IO_URING_WRITE)
+			tbuf_printf(out, "      state: %s uring" CRLF,
+				    ev_is_active(&io->in) ? "in" : "");
+		else
+			tbuf_printf(out, "      state: %s%s" CRLF,
+				    ev_is_active(&io->in) ? "in" : "",
+				    ev_is_active(&io->out) ? "out" : "");
 		tbuf_printf(out, "      rbuf: %i" CRLF, rbuf_len(io));
 		tbuf_printf(out, "      pending_bytes: %zi" CRLF, io->wbuf.bytes);
+		tbuf_printf(out, "      weight: %i" CRLF, c->weight);
+		tbuf_printf(out, "      queued: %i" CRLF, rbuf_count_req(io, INT_MAX));
+		tbuf_printf(out, "      inflight: %i" CRLF, c->inflight);
+		tbuf_printf(out, "      deficit: %i" CRLF, c->deficit);
+		tbuf_printf(out, "      avg_wait: %.6f" CRLF,
+			    c->dispatched > 0 ? c->wait_time / c->dispatched : 0.);
 		if (!TAILQ_EMPTY(&io->wbuf.q))
 			tbuf_printf(out, "      out_messages:" CRLF);
 		TAILQ_FOREACH(m, &io->wbuf.q, link)
@@ -690,8 +1868,16 @@ iproto_fixup_addr(struct octopus_cfg *cfg)
 		return -1;
 	}
 #if CFG_primary_port && CFG_secondary_port
+	/* address list must carry explicit ports */
+	if (strchr(cfg->primary_addr, ',') != NULL) {
+		if (cfg->primary_port)
+			out_warning(0, "Option 'primary_port' is ignored, 'primary_addr' is a list");
+		goto secondary;
+	}
+
 	if (strchr(cfg->primary_addr, ':') == NULL &&
 	    strchr(cfg->primary_addr, '/') == NULL &&
+	    cfg->primary_addr[0] != '@' &&
 	    !cfg->primary_port)
 	{
 		out_warning(0, "Option 'primary_port' is not set");
@@ -700,7 +1886,10 @@ iproto_fixup_addr(struct octopus_cfg *cfg)
 
 	if (net_fixup_addr(&cfg->primary_addr, cfg->primary_port) < 0)
 		out_warning(0, "Option 'primary_addr' is overridden by 'primary_port'");
+secondary:
 
+	if (cfg->secondary_addr && strchr(cfg->secondary_addr, ',') != NULL)
+		return 0;
 	if (net_fixup_addr(&cfg->secondary_addr, cfg->secondary_port) < 0)
 		out_warning(0, "Option 'secondary_addr' is overridden by 'secondary_port'");
 #endif
@@ -721,6 +1910,7 @@ iproto_init(void)
 {
 	stat_base = stat_register(stat_ops, nelem(stat_ops));
 	stat_cb_base = stat_register_callback("stat", report_ingress_cnt);
+	trace_stat_base = stat_register_named("iproto_trace");
 }
 
 register_source();
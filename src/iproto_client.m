@@ -46,6 +46,7 @@
 
 static struct slab_cache future_cache;
 static struct mh_i32_t *sync2future;
+static int proxy_stat_base = -1;
 
 static void __attribute__((constructor))
 iproto_registry_init()
@@ -75,6 +76,8 @@ mbox_future(struct iproto_egress *dst, struct iproto_mbox *mbox, u32 sync)
 	TAILQ_INSERT_HEAD(&dst->future, future, link);
 	future->dst = dst;
 	future->sync = sync;
+	future->sent = ev_now();
+	dst->inflight++;
 	if (mbox != blackhole_mbox) {
 		future->type = IPROTO_FUTURE_MBOX;
 		future->mbox = mbox;
@@ -94,6 +97,8 @@ proxy_future(struct iproto_egress *dst, struct iproto_ingress *src, const struct
 	TAILQ_INSERT_HEAD(&dst->future, future, link);
 	future->dst = dst;
 	future->sync = sync;
+	future->sent = ev_now();
+	dst->inflight++;
 	future->proxy_request = (struct iproto){ .shard_id = msg->shard_id,
 						 .msg_code = msg->msg_code,
 						 .sync = msg->sync };
@@ -288,10 +293,28 @@ iproto_sync_send(struct iproto_egress *peer,
 	return future;
 }
 
+/* least outstanding connection of the pool, ties are broken in favour of
+   connection having unsent data: it will be written by the same writev() */
+static struct iproto_egress *
+pool_select(struct iproto_egress *peer)
+{
+	struct iproto_egress *best = peer;
+	for (struct iproto_egress *p = peer->pool_next; p != NULL; p = p->pool_next) {
+		if (p->fd < 0)
+			continue;
+		if (best->fd < 0 || p->inflight < best->inflight ||
+		    (p->inflight == best->inflight && best->wbuf.bytes == 0 && p->wbuf.bytes > 0))
+			best = p;
+	}
+	return best;
+}
+
 u32
 iproto_proxy_send(struct iproto_egress *to, struct iproto_ingress *from, u32 wrap_code,
 		  const struct iproto *msg, const struct iovec *iov, int iovcnt)
 {
+	if (to->pool_next != NULL)
+		to = pool_select(to);
 	say_debug2("%s: shard:%i op:0x%x %s", __func__, msg->shard_id, msg->msg_code, wrap_code ? "WRAP" : "");
 
 	u32 sync = wrap_code ?
@@ -345,6 +368,7 @@ iproto_future_err(struct iproto_future *future)
 	struct netmsg_io *io;
 
 	mh_i32_remove(sync2future, future->sync, NULL);
+	future->dst->inflight--;
 	switch (future->type) {
 	case IPROTO_FUTURE_MBOX:
 		LIST_REMOVE(future, waiting_link);
@@ -357,7 +381,7 @@ iproto_future_err(struct iproto_future *future)
 		io = future->ingress;
 		iproto_error(&io->wbuf, &future->proxy_request,
 			     ERR_CODE_BAD_CONNECTION, "proxy connection failed");
-		ev_io_start(&io->out);
+		[future->ingress reply_ready];
 		slab_cache_free(&future_cache, future);
 		break;
 	case IPROTO_FUTURE_BLACKHOLE:
@@ -423,6 +447,15 @@ iproto_future_resolve(struct iproto_egress *peer, struct iproto *msg)
 		return;
 	}
 
+	ev_tstamp rtt = ev_now() - future->sent;
+	peer->inflight--;
+	peer->rtt = peer->rtt > 0 ? peer->rtt * 0.9 + rtt * 0.1 : rtt;
+	if (peer->pool_next != NULL || peer->pool_member) {
+		char name[64];
+		int len = snprintf(name, sizeof(name), "%s_rtt_us", sintoa(&peer->ts.daddr));
+		stat_aggregate_named(proxy_stat_base, name, len, rtt * 1e6);
+	}
+
 	switch (future->type) {
 	case IPROTO_FUTURE_MBOX:
 		LIST_REMOVE(future, waiting_link);
@@ -437,7 +470,7 @@ iproto_future_resolve(struct iproto_egress *peer, struct iproto *msg)
 			struct netmsg_io *io = future->ingress;
 			msg->sync = future->proxy_request.sync;
 			net_add_iov_dup(&io->wbuf, msg, sizeof(*msg) + msg->data_len);
-			ev_io_start(&io->out);
+			[future->ingress reply_ready];
 		}
 		slab_cache_free(&future_cache, future);
 		break;
@@ -488,7 +521,7 @@ iproto_remote_add_peer(struct iproto_egress *peer, const struct sockaddr_in *dad
 		SLIST_FOREACH(ts, &iproto_tac_list, link) {
 			peer = container_of(ts, struct iproto_egress, ts);
 			if (memcmp(&ts->daddr, daddr, sizeof(*daddr)) == 0 &&
-			    peer->ctx == ctx)
+			    peer->ctx == ctx && !peer->pool_member)
 				return peer;
 		}
 
@@ -508,6 +541,48 @@ iproto_remote_add_peer(struct iproto_egress *peer, const struct sockaddr_in *dad
 	return peer;
 }
 
+static void
+report_proxy_pool(int base _unused_)
+{
+	struct tac_state *ts;
+	char name[64];
+	SLIST_FOREACH(ts, &iproto_tac_list, link) {
+		struct iproto_egress *peer = container_of(ts, struct iproto_egress, ts);
+		if (peer->pool_next == NULL)
+			continue;
+		int inflight = 0;
+		for (struct iproto_egress *p = peer; p != NULL; p = p->pool_next)
+			inflight += p->inflight;
+		int len = snprintf(name, sizeof(name), "%s_inflight", sintoa(&ts->daddr));
+		stat_report_gauge(name, len, inflight);
+	}
+}
+
+/* several connections to the same peer, iproto_proxy_send() to the returned
+   egress picks the least outstanding one */
+struct iproto_egress *
+iproto_remote_add_peer_pool(const struct sockaddr_in *daddr, struct netmsg_pool_ctx *ctx, int size)
+{
+	struct iproto_egress *peer = iproto_remote_add_peer(NULL, daddr, ctx);
+	int count = 1;
+	for (struct iproto_egress *p = peer->pool_next; p != NULL; p = p->pool_next)
+		count++;
+
+	if (count < size && proxy_stat_base < 0) {
+		proxy_stat_base = stat_register_named("iproto_proxy");
+		stat_register_callback("iproto_proxy", report_proxy_pool);
+	}
+
+	for (; count < size; count++) {
+		struct iproto_egress *p = [iproto_egress alloc];
+		p->pool_member = true;
+		iproto_remote_add_peer(p, daddr, ctx);
+		p->pool_next = peer->pool_next;
+		peer->pool_next = p;
+	}
+	return peer;
+}
+
 void
 iproto_remote_stop_reconnect(struct iproto_egress *peer)
 {
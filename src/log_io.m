@@ -34,6 +34,7 @@
 #import <shard.h>
 
 #include <third_party/crc32.h>
+#include <third_party/lz4/lz4.h>
 
 #include <dirent.h>
 #include <errno.h>
@@ -43,6 +44,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif
 
 #if !HAVE_DECL_FDATASYNC
 extern int fdatasync(int fd);
@@ -71,6 +76,7 @@ const u32 default_version = 12;
 const u32 version_11 = 11;
 const char *v11 = "0.11\n";
 const char *v12 = "0.12\n";
+const char *v13 = "0.13\n";
 const char *v04 = "0.04\n";
 const char *v03 = "0.03\n";
 const char *snap_mark = "SNAP\n";
@@ -213,6 +219,8 @@ open_for_read_filename:(const char *)filename dir:(XLogDir *)dir
 		}
 	} else if (strcmp(version_, v12) == 0) {
 		l = [XLog12 alloc];
+	} else if (strcmp(version_, v13) == 0) {
+		l = [XLog13 alloc];
 	} else if (strcmp(version_, v04) == 0) {
 		if (version4 != nil) {
 			l = [version4 alloc];
@@ -270,8 +278,8 @@ free
 {
 	ev_stat_stop(&stat);
 
-	if (mode == LOG_READ && rows == 0 && access(filename, F_OK) == 0) {
-		bool legacy_snap = ![self isMemberOf:[XLog12 class]] &&
+	if (mode == LOG_READ && rows == 0 && !abandoned && access(filename, F_OK) == 0) {
+		bool legacy_snap = ![self isKindOf:[XLog12 class]] &&
 				   [dir isMemberOf:[SnapDir class]];
 		if (!legacy_snap)
 			panic("no valid rows were read");
@@ -289,6 +297,13 @@ free
 	return [super free];
 }
 
+- (id)
+abandon
+{
+	abandoned = true;
+	return [self free];
+}
+
 - (size_t)
 rows
 {
@@ -596,7 +611,7 @@ append_row:(struct row_v12 *)row data:(const void *)data
 - (const struct row_v12 *)
 append_row:(const void *)data len:(u32)len scn:(i64)scn tag:(u16)tag
 {
-	static struct row_v12 row;
+	static __thread struct row_v12 row;
 	row = (struct row_v12){ .scn = scn,
 				.tm = ev_now(),
 				.tag = tag,
@@ -608,7 +623,7 @@ append_row:(const void *)data len:(u32)len scn:(i64)scn tag:(u16)tag
 - (const struct row_v12 *)
 append_row:(const void *)data len:(u32)len shard:(Shard *)shard tag:(u16)tag
 {
-	static struct row_v12 row;
+	static __thread struct row_v12 row;
 	row = (struct row_v12){ .scn = shard->scn,
 				.tm = ev_now(),
 				.tag = tag,
@@ -681,6 +696,30 @@ fileno
 {
 	return fileno(fd);
 }
+
+- (int)
+seek:(off_t)pos
+{
+	clearerr(fd);
+	if (fseeko(fd, pos, SEEK_SET) < 0) {
+		say_syserror("fseeko");
+		return -1;
+	}
+	return 0;
+}
+
+- (int)
+mark_section:(int)shard_id
+{
+	(void)shard_id;
+	return 0;
+}
+
+- (int)
+write_section_index
+{
+	return 0;
+}
 @end
 
 @implementation XLog04
@@ -1058,6 +1097,110 @@ append_row:(struct row_v12 *)row12 data:(const void *)data
 @implementation XLog12
 - (u32) version { return 12; }
 
+- (id)
+free
+{
+	[part_stream free];
+	free(section_shard);
+	free(section_offset);
+	free(header_scn);
+	return [super free];
+}
+
+- (bool)
+valid_section_index
+{
+	if (section_count == 0 || header_scn == NULL)
+		return false;
+
+	int shards = 0;
+	for (int i = 0; i < MAX_SHARD; i++)
+		if (header_scn[i] != 0)
+			shards++;
+	if (shards != section_count) {
+		say_warn("%s: %i sections for %i shards", filename, section_count, shards);
+		return false;
+	}
+
+	off_t prev = 0;
+	for (int i = 0; i < section_count; i++) {
+		int shard_id = section_shard[i];
+		if (shard_id >= MAX_SHARD || header_scn[shard_id] == 0) {
+			say_warn("%s: section of unknown shard %i", filename, shard_id);
+			return false;
+		}
+		for (int j = 0; j < i; j++)
+			if (section_shard[j] == shard_id) {
+				say_warn("%s: duplicate section of shard %i", filename, shard_id);
+				return false;
+			}
+		if (section_offset[i] <= prev) {
+			say_warn("%s: bad offset of shard %i section", filename, shard_id);
+			return false;
+		}
+		prev = section_offset[i];
+	}
+	if (sections_end <= prev) {
+		say_warn("%s: bad end of sections", filename);
+		return false;
+	}
+	return true;
+}
+
+- (bool)
+reading_parts
+{
+	return next_part > 0 && next_part <= part_count;
+}
+
+/* rows of <manifest>.1 .. <manifest>.N, then the rest of manifest */
+- (struct row_v12 *)
+fetch_part_row
+{
+	while (next_part <= part_count) {
+		if (part_stream == nil) {
+			char name[PATH_MAX];
+			snprintf(name, sizeof(name), "%s.%i", filename, next_part);
+			part_stream = [XLog open_for_read_filename:name dir:dir];
+			if (part_stream == nil) {
+				say_error("can't open snapshot part `%s'", name);
+				return NULL;
+			}
+		}
+
+		struct row_v12 *row = [part_stream fetch_row];
+		if (row != NULL)
+			return row;
+		if (![part_stream eof]) {
+			say_error("unable to fully read snapshot part `%s'", part_stream->filename);
+			return NULL;
+		}
+		[part_stream free];
+		part_stream = nil;
+		next_part++;
+	}
+	return [self fetch_row];
+}
+
+- (void)
+start_parts:(const struct row_v12 *)row
+{
+	if (row != NULL && part == 0 && part_count > 0 && next_part == 0 &&
+	    (row->tag & TAG_MASK) == snap_initial)
+		next_part = 1;
+}
+
+- (struct row_v12 *)
+fetch_row
+{
+	if ([self reading_parts])
+		return [self fetch_part_row];
+
+	struct row_v12 *row = [super fetch_row];
+	[self start_parts:row];
+	return row;
+}
+
 - (int)
 read_header
 {
@@ -1069,6 +1212,38 @@ read_header
                         return -1;
 		if (strcmp(r, "\n") == 0 || strcmp(r, "\r\n") == 0)
                         break;
+
+		int shard_id, p, n;
+		i64 off;
+		if (sscanf(r, "SCN: %"PRIi64, &off) == 1) {
+			if (header_scn == NULL)
+				header_scn = xcalloc(MAX_SHARD, sizeof(*header_scn));
+			header_scn[0] = off;
+		} else if (sscanf(r, "SCN-%i: %"PRIi64, &shard_id, &off) == 2) {
+			if (shard_id < 1 || shard_id >= MAX_SHARD)
+				return -1;
+			if (header_scn == NULL)
+				header_scn = xcalloc(MAX_SHARD, sizeof(*header_scn));
+			header_scn[shard_id] = off;
+		} else if (sscanf(r, "Section-%i: %"PRIi64, &shard_id, &off) == 2) {
+			if (section_count == MAX_SHARD)
+				return -1;
+			if (section_shard == NULL) {
+				section_shard = xmalloc(MAX_SHARD * sizeof(*section_shard));
+				section_offset = xmalloc(MAX_SHARD * sizeof(*section_offset));
+			}
+			section_shard[section_count] = shard_id;
+			section_offset[section_count] = off;
+			section_count++;
+		} else if (sscanf(r, "Section-end: %"PRIi64, &off) == 1) {
+			sections_end = off;
+		} else if (sscanf(r, "Parts: %i", &n) == 1) {
+			part = 0;
+			part_count = n;
+		} else if (sscanf(r, "Part: %i/%i", &p, &n) == 2) {
+			part = p;
+			part_count = n;
+		}
         }
         return 0;
 }
@@ -1077,7 +1252,7 @@ read_header
 write_header:(const i64 *)shard_scn_map
 {
 	fwrite (dir->filetype, strlen(dir->filetype), 1, fd);
-	fwrite (v12, strlen(v12), 1, fd);
+	fprintf (fd, "0.%u\n", [self version]);
 	fprintf (fd, "Created-by: octopus\n");
 	if (cfg.log_io_octopus_version > 0)
 		fprintf (fd, "Octopus-version: %s\n", octopus_version ());
@@ -1096,6 +1271,29 @@ write_header:(const i64 *)shard_scn_map
 		}
 	}
 
+	if (part_count > 0 && part == 0)
+		fprintf (fd, "Parts: %i\n", part_count);
+	else if (part_count > 0)
+		fprintf (fd, "Part: %i/%i\n", part, part_count);
+
+	/* manifest of snapshot split into parts has no sections */
+	if (shard_scn_map && [dir isKindOf:[SnapDir class]] && !(part_count > 0 && part == 0))
+	{
+		/* fixed width placeholders, -write_section_index will overwrite them */
+		section_index_offset = ftello(fd);
+		section_shard = xmalloc(MAX_SHARD * sizeof(*section_shard));
+		section_offset = xcalloc(MAX_SHARD, sizeof(*section_offset));
+		for (int i = 0; i < MAX_SHARD; ++i)
+		{
+			if (shard_scn_map[i] == 0)
+				continue;
+
+			section_shard[section_count++] = i;
+			fprintf (fd, "Section-%i: %020"PRIi64"\n", i, (i64)0);
+		}
+		fprintf (fd, "Section-end: %020"PRIi64"\n", (i64)0);
+	}
+
 	fprintf (fd, "\n");
 	if (((offset = ftello(fd)) < 0) || ferror (fd))
 		return -1;
@@ -1229,18 +1427,304 @@ append_row:(struct row_v12 *)row data:(const void *)data
 		return NULL;
 #endif
 
+	if ([self write_row:row data:data] < 0)
+		return NULL;
+	return row;
+}
+
+- (int)
+write_row:(const struct row_v12 *)row data:(const void *)data
+{
 	if (fwrite(&marker, sizeof(marker), 1, fd) != 1 ||
 	    fwrite(row, sizeof(*row), 1, fd) != 1 ||
 	    fwrite(data, row->len, 1, fd) != 1)
 	{
 		say_syserror("fwrite");
-		return NULL;
+		return -1;
 	}
 
 	[self append_successful:sizeof(marker) + sizeof(*row) + row->len];
-	return row;
+	return 0;
+}
+
+- (int)
+mark_section:(int)shard_id
+{
+	if (section_count == 0)
+		return 0;
+
+	off_t pos = ftello(fd);
+	if (pos < 0) {
+		say_syserror("ftello");
+		return -1;
+	}
+
+	if (shard_id < 0) {
+		sections_end = pos;
+		return 0;
+	}
+
+	for (int i = 0; i < section_count; i++) {
+		if (section_shard[i] == shard_id) {
+			section_offset[i] = pos;
+			return 0;
+		}
+	}
+	/* reader will fall back to sequential loading */
+	say_warn("shard %i is missing in section index", shard_id);
+	return 0;
 }
 
+- (int)
+write_section_index
+{
+	if (section_count == 0)
+		return 0;
+
+	struct tbuf *b = tbuf_alloc(fiber->pool);
+	for (int i = 0; i < section_count; i++)
+		tbuf_printf(b, "Section-%i: %020"PRIi64"\n",
+			    section_shard[i], (i64)section_offset[i]);
+	tbuf_printf(b, "Section-end: %020"PRIi64"\n", (i64)sections_end);
+
+	/* header may still sit in stdio buffer */
+	if (fflush(fd) < 0) {
+		say_syserror("fflush");
+		return -1;
+	}
+	if (pwrite(fileno(fd), b->ptr, tbuf_len(b), section_index_offset) != tbuf_len(b)) {
+		say_syserror("pwrite");
+		return -1;
+	}
+	return 0;
+}
+@end
+
+struct block_v13 {
+	u32 header_crc32c;
+	u32 len;		/* uncompressed size */
+	u32 zlen;		/* compressed size */
+	u32 rows;
+	u32 data_crc32c;	/* crc32c of compressed data */
+} __attribute__((packed));
+
+static const u32 block_v13_size = 128 * 1024;
+
+static char *
+ensure_buf(char *buf, size_t *size, size_t required)
+{
+	if (*size >= required)
+		return buf;
+
+	size_t new_size = *size ?: 64 * 1024;
+	while (new_size < required)
+		new_size *= 2;
+	*size = new_size;
+	return xrealloc(buf, new_size);
+}
+
+@implementation XLog13
+- (u32) version { return 13; }
+
+- (id)
+free
+{
+	/* base -free flushes pending block through -write_eof_marker */
+	char *b = block, *zb = zblock;
+	[super free];
+	free(b);
+	free(zb);
+	return nil;
+}
+
+- (int)
+write_block
+{
+	if (block_len == 0)
+		return 0;
+
+	struct block_v13 h = { .len = block_len,
+			       .rows = block_rows };
+
+	zblock = ensure_buf(zblock, &zblock_size, LZ4_compressBound(block_len));
+	int zlen = LZ4_compress_limitedOutput(block, zblock, block_len, zblock_size);
+	if (zlen <= 0) {
+		say_error("lz4 compression failed");
+		return -1;
+	}
+
+	h.zlen = zlen;
+	h.data_crc32c = crc32c(0, (unsigned char *)zblock, zlen);
+	h.header_crc32c = crc32c(0, (unsigned char *)&h + sizeof(h.header_crc32c),
+				 sizeof(h) - sizeof(h.header_crc32c));
+
+	if (fwrite(&marker, sizeof(marker), 1, fd) != 1 ||
+	    fwrite(&h, sizeof(h), 1, fd) != 1 ||
+	    fwrite(zblock, zlen, 1, fd) != 1)
+	{
+		say_syserror("fwrite");
+		return -1;
+	}
+
+	zbytes += sizeof(marker) + sizeof(h) + zlen;
+	block_len = block_rows = 0;
+	return 0;
+}
+
+- (int)
+write_row:(const struct row_v12 *)row data:(const void *)data
+{
+	/* rows are buffered until the whole block is written,
+	   there is no way to confirm them one by one */
+	assert(no_wet);
+
+	u32 row_size = sizeof(*row) + row->len;
+	if (block_len > 0 && block_len + row_size > block_v13_size)
+		if ([self write_block] < 0)
+			return -1;
+
+	block = ensure_buf(block, &block_size, block_len + row_size);
+	memcpy(block + block_len, row, sizeof(*row));
+	memcpy(block + block_len + sizeof(*row), data, row->len);
+	block_len += row_size;
+	block_rows++;
+
+	[self append_successful:row_size];
+	return 0;
+}
+
+- (int)
+flush
+{
+	if ([self write_block] < 0)
+		return -1;
+	return [super flush];
+}
+
+- (int)
+write_eof_marker
+{
+	if ([self write_block] < 0)
+		return -1;
+	return [super write_eof_marker];
+}
+
+- (int)
+mark_section:(int)shard_id
+{
+	/* section must start at block boundary */
+	if ([self write_block] < 0)
+		return -1;
+	return [super mark_section:shard_id];
+}
+
+- (int)
+write_section_index
+{
+	if ([self write_block] < 0)
+		return -1;
+	return [super write_section_index];
+}
+
+- (int)
+seek:(off_t)pos
+{
+	block_len = block_pos = 0;
+	return [super seek:pos];
+}
+
+- (struct row_v12 *)
+block_row
+{
+	const struct row_v12 *r = (const struct row_v12 *)(block + block_pos);
+
+	if (block_len - block_pos < sizeof(*r) ||
+	    block_len - block_pos - sizeof(*r) < r->len)
+	{
+		say_error("row is too short");
+		block_len = block_pos = 0;
+		return NULL;
+	}
+
+	struct tbuf *m = tbuf_alloc(fiber->pool);
+	tbuf_append(m, r, sizeof(*r) + r->len);
+	block_pos += sizeof(*r) + r->len;
+
+	fixup_row_v12(row_v12(m));
+	say_debug2("%s: LSN:%" PRIi64, __func__, row_v12(m)->lsn);
+
+	return m->ptr;
+}
+
+- (struct row_v12 *)
+read_row
+{
+	struct block_v13 h;
+
+	block_len = block_pos = 0;
+	if (fread(&h, sizeof(h), 1, fd) != 1) {
+		if (ferror(fd))
+			say_error("fread error");
+		return NULL;
+	}
+
+	if (h.header_crc32c != crc32c(0, (unsigned char *)&h + sizeof(h.header_crc32c),
+				      sizeof(h) - sizeof(h.header_crc32c)))
+	{
+		say_error("block header crc32c mismatch");
+		return NULL;
+	}
+
+	if (h.len == 0 || h.len > LZ4_MAX_INPUT_SIZE ||
+	    h.zlen > (u32)LZ4_compressBound(h.len))
+	{
+		say_error("bad block size");
+		return NULL;
+	}
+
+	zblock = ensure_buf(zblock, &zblock_size, h.zlen);
+	if (fread(zblock, h.zlen, 1, fd) != 1) {
+		if (ferror(fd))
+			say_error("fread error");
+		return NULL;
+	}
+
+	if (h.data_crc32c != crc32c(0, (unsigned char *)zblock, h.zlen)) {
+		say_error("block data crc32c mismatch");
+		return NULL;
+	}
+
+	block = ensure_buf(block, &block_size, h.len);
+	if (LZ4_decompress_safe(zblock, block, h.zlen, h.len) != (int)h.len) {
+		say_error("lz4 decompression failed");
+		return NULL;
+	}
+
+	block_len = h.len;
+	block_rows = h.rows;
+	return [self block_row];
+}
+
+- (struct row_v12 *)
+fetch_row
+{
+	if ([self reading_parts])
+		return [self fetch_part_row];
+
+	/* next block is fetched with marker scanning, rest of its rows are
+	   taken from decompressed buffer */
+	if (block_pos == block_len)
+		return [super fetch_row];
+
+	struct row_v12 *row = [self block_row];
+	if (row == NULL)
+		return NULL;
+
+	++rows;
+	last_read_lsn = row->lsn;
+	[self start_parts:row];
+	return row;
+}
 @end
 
 @implementation XLogDir
@@ -1354,6 +1838,42 @@ scan_dir:(i64 **)ret_lsn
 	return result;
 }
 
+/* part files <lsn>.snap.<n> are useless without <lsn>.snap which is
+   renamed last: remove parts of interrupted snapshots and parts left
+   after the manifest was deleted */
+- (void)
+remove_orphan_parts
+{
+	DIR *dh = opendir(dirname);
+	struct dirent *dent;
+
+	if (dh == NULL) {
+		say_syserror("can't open directory `%s'", dirname);
+		return;
+	}
+
+	while ((dent = readdir(dh)) != NULL) {
+		char *end;
+		int part, n = 0;
+		i64 lsn = strtoll(dent->d_name, &end, 10);
+
+		if (end == dent->d_name || strncmp(end, suffix, strlen(suffix)) != 0)
+			continue;
+		end += strlen(suffix);
+		if (sscanf(end, ".%i%n", &part, &n) != 1 || n == 0 || part <= 0)
+			continue;
+		if (end[n] != 0 && strcmp(end + n, inprogress_suffix) != 0)
+			continue;
+		if (access([self format_filename:lsn], F_OK) == 0)
+			continue;
+
+		say_warn("removing orphan snapshot part `%s/%s'", dirname, dent->d_name);
+		if (unlinkat(dirfd(dh), dent->d_name, 0) < 0)
+			say_syserror("can't remove `%s/%s'", dirname, dent->d_name);
+	}
+	closedir(dh);
+}
+
 - (i64)
 greatest_lsn
 {
@@ -1401,7 +1921,7 @@ out:
 - (const char *)
 format_filename:(i64)lsn prefix:(const char *)prefix suffix:(const char *)extra_suffix
 {
-	static char filename[PATH_MAX + 1];
+	static __thread char filename[PATH_MAX + 1];
 	snprintf(filename, sizeof(filename),
 		 "%s%s/%020" PRIi64 "%s%s",
 		 prefix, dirname, lsn, suffix, extra_suffix);
@@ -1434,23 +1954,28 @@ open_for_read:(i64)lsn
 int allow_snap_overwrite = 0;
 - (XLog *)
 open_for_write:(i64)lsn scn:(i64 *)shard_scn_map
+{
+	return [self open_for_write:lsn scn:shard_scn_map spare:NULL];
+}
+
+- (XLog *)
+create:(const char *)filename lsn:(i64)lsn scn:(i64 *)shard_scn_map
+  spare:(const char *)spare_filename part:(int)part of:(int)parts
 {
         XLog *l = nil;
         FILE *file = NULL;
-        assert(lsn > 0);
 	char *fbuf = NULL;
 
-	const char *final_filename = [self format_filename:lsn];
-	if (!allow_snap_overwrite && access(final_filename, F_OK) == 0) {
-		errno = EEXIST;
-		say_error("failed to create '%s': file already exists", final_filename);
-		goto error;
-	}
-
-	const char *filename = [self format_filename:lsn suffix:inprogress_suffix];
-
 	/* .inprogress file can't contain confirmed records, overwrite it silently */
-	file = fopen(filename, "w");
+	if (spare_filename != NULL && rename(spare_filename, filename) == 0) {
+		int fdn = open(filename, O_WRONLY);
+		if (fdn >= 0 && (file = fdopen(fdn, "w")) == NULL)
+			close(fdn);
+	} else {
+		if (spare_filename != NULL)
+			say_syserror("can't rename %s to %s", spare_filename, filename);
+		file = fopen(filename, "w");
+	}
 	if (file == NULL) {
 		say_syserror("fopen of %s for writing failed", filename);
 		goto error;
@@ -1465,7 +1990,11 @@ open_for_write:(i64)lsn scn:(i64 *)shard_scn_map
 
 	l->next_lsn = lsn;
 	l->mode = LOG_WRITE;
-	l->inprogress = 1;
+	if (parts > 0) {
+		assert([l isKindOf:[XLog12 class]]);
+		((XLog12 *)l)->part = part;
+		((XLog12 *)l)->part_count = parts;
+	}
 
 	if ([l write_header:shard_scn_map] < 0) {
 		say_syserror("failed to write header");
@@ -1481,6 +2010,48 @@ open_for_write:(i64)lsn scn:(i64 *)shard_scn_map
 	return NULL;
 }
 
+- (XLog *)
+open_for_write:(i64)lsn scn:(i64 *)shard_scn_map spare:(const char *)spare_filename
+	  part:(int)part of:(int)parts
+{
+        assert(lsn > 0);
+
+	const char *final_filename = [self format_filename:lsn];
+	if (!allow_snap_overwrite && access(final_filename, F_OK) == 0) {
+		errno = EEXIST;
+		say_error("failed to create '%s': file already exists", final_filename);
+		return NULL;
+	}
+
+	char part_suffix[32];
+	snprintf(part_suffix, sizeof(part_suffix), ".%i%s", part, inprogress_suffix);
+	const char *filename = [self format_filename:lsn
+					      suffix:part > 0 ? part_suffix : inprogress_suffix];
+	XLog *l = [self create:filename lsn:lsn scn:shard_scn_map
+			 spare:part > 0 ? NULL : spare_filename part:part of:parts];
+	if (l != nil)
+		l->inprogress = 1;
+	return l;
+}
+
+/* spare_filename is an empty preallocated file, which is renamed
+   instead of creating new one. it's not truncated, so preallocated
+   blocks are kept */
+- (XLog *)
+open_for_write:(i64)lsn scn:(i64 *)shard_scn_map spare:(const char *)spare_filename
+{
+	return [self open_for_write:lsn scn:shard_scn_map spare:spare_filename part:0 of:0];
+}
+
+/* snapshot may be split into parts: <lsn>.snap is a manifest (part 0)
+   and <lsn>.snap.<part> hold shard sections. all of them are written
+   as .inprogress, parts are renamed before the manifest */
+- (XLog *)
+open_for_write:(i64)lsn scn:(i64 *)shard_scn_map part:(int)part of:(int)parts
+{
+	return [self open_for_write:lsn scn:shard_scn_map spare:NULL part:part of:parts];
+}
+
 
 static i64
 find(int count, const char *type, i64 needle, i64 *haystack, i64 *lsn)
@@ -1589,70 +2160,197 @@ init_dirname:(const char *)dirname_
 }
 @end
 
-@interface Snap12 : XLog12 {
-	size_t bytes;
-	ev_tstamp step_ts, last_ts;
-}@end
+struct wal_io_stat *wal_io_stat;
 
-@implementation Snap12
-- (const struct row_v12 *)
-append_row:(struct row_v12 *)row12 data:(const void *)data
+static void __attribute__((constructor))
+wal_io_stat_init(void)
 {
-	const struct row_v12 *ret = [super append_row:row12 data:data];
-	if (ret == NULL)
-		return NULL;
+	/* must be shared by the WAL writer and the snapshot dumper,
+	   so map it before anything forks */
+	void *p = mmap(NULL, sizeof(*wal_io_stat), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p != MAP_FAILED)
+		wal_io_stat = p;
+}
 
-	bytes += sizeof(*row12) + row12->len;
+void
+wal_io_stat_start(void)
+{
+	if (wal_io_stat != NULL)
+		wal_io_stat->fsync_start = ev_time();
+}
 
-	if (rows & 31)
-		return ret;
+void
+wal_io_stat_report(ev_tstamp fsync_time)
+{
+	if (wal_io_stat == NULL)
+		return;
+	wal_io_stat->fsync_start = 0;
+	if (fsync_time < 0)
+		return;
+	if (wal_io_stat->fsync_count == 0)
+		wal_io_stat->fsync_time = fsync_time;
+	else
+		wal_io_stat->fsync_time = wal_io_stat->fsync_time * 0.8 + fsync_time * 0.2;
+	wal_io_stat->fsync_count++;
+}
 
-	ev_now_update();
-	if (last_ts == 0) {
-		last_ts = ev_now();
-		step_ts = ev_now();
-	}
+/* token bucket shared by all snapshot writers of the process (parts are
+   written by several threads). rate == 0 means unlimited. */
+static struct snap_io_bucket {
+#ifdef THREADS
+	pthread_mutex_t mtx;
+#endif
+	double tokens, rate;
+	ev_tstamp refill_ts, adjust_ts;
+	size_t adjust_bytes;
+	u64 fsync_count;
+} snap_io_bucket = {
+#ifdef THREADS
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
 
-	const int io_rate_limit = cfg.snap_io_rate_limit * 1024 * 1024;
-	if (io_rate_limit <= 0) {
-		if (ev_now() - step_ts > 0.1) {
-			if ([self flush] < 0)
-				return NULL;
-			if (cfg.snap_fadvise_dont_need)
-				[self fadvise_dont_need];
-			ev_now_update();
-			step_ts = ev_now();
-		}
-		return ret;
+/* AIMD: while WAL fdatasync is slower than snap_wal_latency_target the rate is
+   cut proportionally (down to snap_io_rate_min), otherwise it grows back
+   to snap_io_rate_limit or becomes unlimited */
+static void
+snap_io_adjust(struct snap_io_bucket *b, ev_tstamp now)
+{
+	const double max = cfg.snap_io_rate_limit * 1024 * 1024,
+		     min = cfg.snap_io_rate_min * 1024 * 1024,
+		     target = cfg.snap_wal_latency_target;
+
+	if (b->adjust_ts == 0) {
+		b->adjust_ts = b->refill_ts = now;
+		b->rate = max > 0 ? max : 0;
+		b->tokens = 0;
+		return;
 	}
+	if (now - b->adjust_ts < 0.1)
+		return;
 
-	if (ev_now() - step_ts > 0.02) {
-		double delta = ev_now() - last_ts;
-		size_t bps = bytes / delta;
+	double throughput = b->adjust_bytes / (now - b->adjust_ts);
+	b->adjust_bytes = 0;
+	b->adjust_ts = now;
 
-		if (bps > io_rate_limit) {
-			if ([self flush] < 0)
-				return NULL;
-			if (cfg.snap_fadvise_dont_need)
-				[self fadvise_dont_need];
-			ev_now_update();
-			delta = ev_now() - last_ts;
-			bps = bytes / delta;
+	double fsync_time = 0;
+	if (target > 0 && wal_io_stat != NULL) {
+		if (wal_io_stat->fsync_count != b->fsync_count) {
+			b->fsync_count = wal_io_stat->fsync_count;
+			fsync_time = wal_io_stat->fsync_time;
 		}
+		/* slow fdatasync reports nothing until it completes:
+		   it is too slow already if it runs longer than target */
+		ev_tstamp start = wal_io_stat->fsync_start;
+		if (start > 0 && now - start > fsync_time)
+			fsync_time = now - start;
+	}
 
-		if (bps > io_rate_limit) {
-			double sec = delta * (bps - io_rate_limit) / io_rate_limit;
-			usleep(sec * 1e6);
-			ev_now_update();
-		}
-		step_ts = ev_now();
+	if (fsync_time > target) {
+		double rate = b->rate > 0 ? b->rate : throughput;
+		rate *= target / fsync_time;
+		b->rate = rate > min ? rate : min;
+		if (b->rate < 64 * 1024)
+			b->rate = 64 * 1024;
+	} else if (b->rate > 0) {
+		b->rate *= 1.25;
+		if (max > 0 && b->rate >= max)
+			b->rate = max;
+		else if (max <= 0 && b->rate > throughput * 2)
+			b->rate = 0; /* not limiting anymore */
 	}
+}
+
+struct snap_io_rate {
+	size_t bytes;
+	ev_tstamp flush_ts;
+};
+
+static int
+snap_io_rate_limit(XLog *snap, struct snap_io_rate *r, size_t rows)
+{
+	if (rows & 31)
+		return 0;
+
+	/* snapshot may be written by a thread, don't touch event loop time */
+	ev_tstamp now = ev_time(), delay = 0;
+	struct snap_io_bucket *b = &snap_io_bucket;
 
-	if (ev_now() > last_ts + 1) {
-		bytes = 0;
-		last_ts = step_ts = ev_now();
+	if (r->flush_ts == 0)
+		r->flush_ts = now;
+
+#ifdef THREADS
+	pthread_mutex_lock(&b->mtx);
+#endif
+	b->adjust_bytes += r->bytes;
+	snap_io_adjust(b, now);
+	if (b->rate > 0) {
+		b->tokens += (now - b->refill_ts) * b->rate;
+		if (b->tokens > b->rate * 0.1) /* burst of 100ms */
+			b->tokens = b->rate * 0.1;
+		b->tokens -= r->bytes;
+		if (b->tokens < 0)
+			delay = -b->tokens / b->rate;
+	}
+	b->refill_ts = now;
+#ifdef THREADS
+	pthread_mutex_unlock(&b->mtx);
+#endif
+	r->bytes = 0;
+
+	if (delay > 0 || now - r->flush_ts > 0.1) {
+		/* push dirty pages out before sleeping, otherwise
+		   writeback will burst regardless of the rate */
+		if ([snap flush] < 0)
+			return -1;
+		if (cfg.snap_fadvise_dont_need)
+			[snap fadvise_dont_need];
+		r->flush_ts = ev_time();
+		if (delay > r->flush_ts - now)
+			usleep((delay - (r->flush_ts - now)) * 1e6);
 	}
 
+	return 0;
+}
+
+@interface Snap12 : XLog12 {
+	struct snap_io_rate io_rate;
+}@end
+
+@implementation Snap12
+- (const struct row_v12 *)
+append_row:(struct row_v12 *)row12 data:(const void *)data
+{
+	const struct row_v12 *ret = [super append_row:row12 data:data];
+	if (ret == NULL)
+		return NULL;
+
+	io_rate.bytes += sizeof(*row12) + row12->len;
+	if (snap_io_rate_limit(self, &io_rate, rows) < 0)
+		return NULL;
+	return ret;
+}
+@end
+
+@interface Snap13 : XLog13 {
+	struct snap_io_rate io_rate;
+	size_t zbytes_seen;
+}@end
+
+@implementation Snap13
+- (const struct row_v12 *)
+append_row:(struct row_v12 *)row12 data:(const void *)data
+{
+	const struct row_v12 *ret = [super append_row:row12 data:data];
+	if (ret == NULL)
+		return NULL;
+
+	/* limit actual disk bandwidth, i.e. compressed bytes */
+	io_rate.bytes += zbytes - zbytes_seen;
+	zbytes_seen = zbytes;
+	if (snap_io_rate_limit(self, &io_rate, rows) < 0)
+		return NULL;
 	return ret;
 }
 @end
@@ -1666,9 +2364,9 @@ init_dirname:(const char *)dirname_
 		filetype = snap_mark;
 		suffix = ".snap";
 	}
-	// rate limiting only v12 snapshots
+	// rate limiting only v12/v13 snapshots
 	if (xlog_class == [XLog12 class])
-		xlog_class = [Snap12 class];
+		xlog_class = cfg.snap_compress ? [Snap13 class] : [Snap12 class];
         return self;
 }
 @end
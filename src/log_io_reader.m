@@ -30,6 +30,215 @@
 #import <fiber.h>
 #import <log_io.h>
 #import <pickle.h>
+#import <thread_pool.h>
+
+struct read_ahead;
+
+#ifdef THREADS
+/*
+ * Snapshot read ahead: a thread fetches (reads, verifies crc32c and decodes)
+ * rows into a ring of batches, applying fiber consumes them in order.
+ */
+
+@interface SnapReader: ThreadPool
+@end
+
+struct snap_batch {
+	struct read_ahead *ra;
+	char *data;
+	size_t len, size;
+	u32 rows;
+	bool ready, eof;
+	id error;
+	Fiber *waiter;
+};
+
+struct read_ahead {
+	XLog *stream;
+	SnapReader *reader;
+	struct snap_batch *batch;
+	int count, current;
+	bool section; /* stop after shard_final row */
+	bool loaded, done;
+	volatile bool stop;
+	struct tbuf rows;
+};
+
+static const size_t snap_batch_size = 1024 * 1024;
+
+@implementation SnapReader
+- (i64)
+perform_request:(request_arg)arg
+{
+	struct snap_batch *b = arg.p;
+	struct read_ahead *ra = b->ra;
+
+	b->len = b->rows = 0;
+	if (ra->done || ra->stop) {
+		b->eof = true;
+		return 0;
+	}
+
+	palloc_register_cut_point(fiber->pool);
+	@try {
+		while (b->len < snap_batch_size) {
+			struct row_v12 *row = [ra->stream fetch_row];
+			if (row == NULL) {
+				ra->done = b->eof = true;
+				break;
+			}
+
+			size_t size = sizeof(*row) + row->len;
+			if (b->len + size > b->size) {
+				b->size = MAX(b->size * 2, b->len + size);
+				b->data = xrealloc(b->data, b->size);
+			}
+			memcpy(b->data + b->len, row, size);
+			b->len += size;
+			b->rows++;
+
+			if (ra->section && (row->tag & TAG_MASK) == shard_final) {
+				ra->done = b->eof = true;
+				break;
+			}
+
+			if ((b->rows & 0x1ff) == 0x1ff) {
+				palloc_cutoff(fiber->pool);
+				palloc_register_cut_point(fiber->pool);
+			}
+		}
+	}
+	@finally {
+		palloc_cutoff(fiber->pool);
+	}
+	return b->rows;
+}
+@end
+
+static SnapReader **snap_reader;
+static int snap_readers;
+
+static void
+batch_ready(request_arg arg, i64 res __attribute__((unused)), id error)
+{
+	struct snap_batch *b = arg.p;
+	b->error = error;
+	b->ready = true;
+	if (b->waiter)
+		fiber_wake(b->waiter, NULL);
+}
+
+static void
+batch_request(struct snap_batch *b)
+{
+	b->ready = false;
+	[b->ra->reader send:(request_arg){ .p = b }
+			 cb:batch_ready
+		     cb_arg:(request_arg){ .p = b }];
+}
+
+static void
+batch_wait(struct snap_batch *b)
+{
+	while (!b->ready) {
+		b->waiter = fiber;
+		yield();
+	}
+	b->waiter = NULL;
+}
+
+/* each reader is a single thread: batches of a stream are filled in order */
+static struct read_ahead *
+read_ahead_start(XLog *stream, int count, int worker, bool section)
+{
+	if (worker >= snap_readers) {
+		snap_reader = xrealloc(snap_reader, (worker + 1) * sizeof(*snap_reader));
+		while (snap_readers <= worker)
+			snap_reader[snap_readers++] = [[SnapReader alloc] init_num:1];
+	}
+
+	struct read_ahead *ra = xcalloc(1, sizeof(*ra));
+	ra->stream = stream;
+	ra->reader = snap_reader[worker];
+	ra->section = section;
+	ra->count = count;
+	ra->batch = xcalloc(count, sizeof(*ra->batch));
+	for (int i = 0; i < count; i++) {
+		ra->batch[i].ra = ra;
+		batch_request(&ra->batch[i]);
+	}
+	return ra;
+}
+
+static struct row_v12 *
+read_ahead_fetch_row(struct read_ahead *ra)
+{
+	while (tbuf_len(&ra->rows) == 0) {
+		struct snap_batch *b = &ra->batch[ra->current];
+
+		if (ra->loaded) {
+			if (b->eof)
+				return NULL;
+			batch_request(b);
+			ra->current = (ra->current + 1) % ra->count;
+			ra->loaded = false;
+			continue;
+		}
+
+		batch_wait(b);
+		if (b->error) {
+			id e = b->error;
+			b->error = nil;
+			b->eof = true;
+			@throw e;
+		}
+		ra->rows = TBUF(b->data, b->len, NULL);
+		ra->loaded = true;
+	}
+
+	struct row_v12 *row = ra->rows.ptr;
+	tbuf_ltrim(&ra->rows, sizeof(*row) + row->len);
+	return row;
+}
+
+/* readers are needed only while snapshot is loaded */
+static void
+read_ahead_release_readers(void)
+{
+	for (int i = 0; i < snap_readers; i++) {
+		[snap_reader[i] close];
+		[snap_reader[i] free];
+	}
+	free(snap_reader);
+	snap_reader = NULL;
+	snap_readers = 0;
+}
+
+static void
+read_ahead_free(struct read_ahead *ra)
+{
+	/* in-flight batches reference ra, wait for them */
+	ra->stop = true;
+	for (int i = 0; i < ra->count; i++) {
+		batch_wait(&ra->batch[i]);
+		free(ra->batch[i].data);
+	}
+	free(ra->batch);
+	free(ra);
+}
+#endif
+
+static struct row_v12 *
+next_row(XLog *stream, struct read_ahead *ra)
+{
+#ifdef THREADS
+	if (ra)
+		return read_ahead_fetch_row(ra);
+#else
+	(void)ra;
+#endif
+	return [stream fetch_row];
+}
 
 @implementation XLogReader
 - (i64) lsn { return lsn; }
@@ -45,6 +254,7 @@ init_recovery:(id<RecoverRow>)recovery_
 - (void)
 recover_row_stream:(XLog *)stream
 {
+	struct read_ahead *ra = NULL;
 	@try {
 		unsigned row_count = 0;
 		unsigned estimated_snap_rows = 0;
@@ -52,7 +262,11 @@ recover_row_stream:(XLog *)stream
 		palloc_register_cut_point(fiber->pool);
 
 		if (stream->dir == snap_dir) {
-			row = [stream fetch_row];
+#ifdef THREADS
+			if (cfg.snap_read_ahead > 0)
+				ra = read_ahead_start(stream, cfg.snap_read_ahead, 0, false);
+#endif
+			row = next_row(stream, ra);
 			if (row && (row->tag & TAG_MASK) == snap_initial) {
 				struct tbuf row_data = TBUF(row->data, row->len, NULL);
 				if (row->len == sizeof(u32) * 3) { /* not a dummy row */
@@ -74,7 +288,7 @@ recover_row_stream:(XLog *)stream
 					break;
 		}
 
-		for (; row; row = [stream fetch_row]) {
+		for (; row; row = next_row(stream, ra)) {
 			[recovery recover_row:row];
 
 			if (unlikely(row->lsn - lsn > 1 && cfg.panic_on_lsn_gap))
@@ -100,11 +314,215 @@ recover_row_stream:(XLog *)stream
 			}
 		}
 	}
+	@finally {
+#ifdef THREADS
+		if (ra)
+			read_ahead_free(ra);
+#endif
+		palloc_cutoff(fiber->pool);
+	}
+}
+
+#ifdef THREADS
+static struct read_ahead *
+section_read_ahead(XLog *snap, off_t offset, int worker)
+{
+	XLog *stream = [XLog open_for_read_filename:snap->filename dir:snap->dir];
+	if (stream == nil)
+		raise_fmt("can't open `%s'", snap->filename);
+	if ([stream seek:offset] < 0) {
+		[stream abandon];
+		raise_fmt("can't seek `%s'", snap->filename);
+	}
+	return read_ahead_start(stream, cfg.snap_read_ahead, worker, true);
+}
+
+/* streams of sections not loaded because of an error
+   are abandoned: they may have no rows read yet */
+static void
+section_free(struct read_ahead *ra, bool loaded)
+{
+	XLog *stream = ra->stream;
+	read_ahead_free(ra);
+	if (loaded)
+		[stream free];
+	else
+		[stream abandon];
+}
+
+/* all rows of a snapshot have its LSN, rows of a section belong to its
+   shard (shard_id == -1 for a part file) and shard_final rows carry SCN
+   from the header of the stream */
+- (void)
+recover_section:(struct read_ahead *)ra shard:(int)shard_id
+{
+	struct row_v12 *row;
+	u16 tag = 0;
+	unsigned row_count = 0;
+	const i64 *scn = NULL;
+	if ([ra->stream isKindOf:[XLog12 class]])
+		scn = ((XLog12 *)ra->stream)->header_scn;
+
+	palloc_register_cut_point(fiber->pool);
+	@try {
+		while ((row = read_ahead_fetch_row(ra))) {
+			if (row->lsn != lsn)
+				raise_fmt("row LSN %"PRIi64" in snapshot %"PRIi64, row->lsn, lsn);
+			if (shard_id >= 0 && row->shard_id != shard_id)
+				raise_fmt("row of shard %i in section of shard %i", row->shard_id, shard_id);
+			tag = row->tag & TAG_MASK;
+			if (tag == shard_final && scn != NULL &&
+			    (row->shard_id >= MAX_SHARD || row->scn != scn[row->shard_id]))
+				raise_fmt("shard %i: final SCN %"PRIi64" doesn't match header",
+					  row->shard_id, row->scn);
+			[recovery recover_row:row];
+
+			if ((++row_count & 0x1ff) == 0x1ff) {
+				palloc_cutoff(fiber->pool);
+				palloc_register_cut_point(fiber->pool);
+			}
+		}
+	}
 	@finally {
 		palloc_cutoff(fiber->pool);
 	}
+
+	if (tag != shard_final)
+		raise_fmt("unable to fully read snapshot section");
+}
+#endif
+
+/*
+ * Shard sections of indexed snapshot are read and decoded concurrently
+ * by several threads, rows are applied by this fiber section by section.
+ * That is snap_read_ahead with one stream per thread: indexes are still
+ * built by a single fiber, recover_row: and index updates are not thread
+ * safe, so loading speeds up only when reading and decoding are the
+ * bottleneck.
+ * On return all sections are loaded and snap is positioned at the tail.
+ */
+- (void)
+recover_snap_sections:(XLog *)snap
+{
+#ifdef THREADS
+	if (cfg.snap_read_threads < 2 || cfg.snap_read_ahead <= 0 ||
+	    ![snap isKindOf:[XLog12 class]])
+		return;
+
+	XLog12 *snap12 = (XLog12 *)snap;
+	int count = snap12->section_count;
+	if (count < 2 || ![snap12 valid_section_index])
+		return;
+
+	struct row_v12 *row = [snap fetch_row];
+	if (row == NULL || (row->tag & TAG_MASK) != snap_initial)
+		raise_fmt("snap_initial row is missing");
+	[recovery recover_row:row];
+	lsn = row->lsn;
+
+	int threads = MIN(cfg.snap_read_threads, count);
+	struct read_ahead **ra = xcalloc(count, sizeof(*ra));
+	say_info("loading %i shard sections using %i threads", count, threads);
+	@try {
+		for (int i = 0; i < threads; i++)
+			ra[i] = section_read_ahead(snap, snap12->section_offset[i], i);
+
+		for (int i = 0; i < count; i++) {
+			[self recover_section:ra[i] shard:snap12->section_shard[i]];
+			section_free(ra[i], true);
+			ra[i] = NULL;
+
+			if (i + threads < count)
+				ra[i + threads] = section_read_ahead(snap, snap12->section_offset[i + threads],
+								     i % threads);
+
+			float pct = 100. * (i + 1) / count;
+			say_info("%i/%.2f%% shard sections recovered", i + 1, pct);
+			title("loading %.2f%%", pct);
+		}
+	}
+	@finally {
+		for (int i = 0; i < count; i++)
+			if (ra[i])
+				section_free(ra[i], false);
+		free(ra);
+	}
+
+	if ([snap seek:snap12->sections_end] < 0)
+		raise_fmt("can't seek `%s'", snap->filename);
+#else
+	(void)snap;
+#endif
+}
+
+#ifdef THREADS
+static XLog *
+open_part(XLog *snap, int part)
+{
+	char filename[PATH_MAX];
+	snprintf(filename, sizeof(filename), "%s.%i", snap->filename, part);
+	XLog *stream = [XLog open_for_read_filename:filename dir:snap->dir];
+	if (stream == nil)
+		raise_fmt("can't open snapshot part `%s'", filename);
+	return stream;
 }
+#endif
 
+/*
+ * Snapshot split into part files: snap is a manifest with snap_initial and
+ * snap_final rows only, shard sections are stored in <snap>.<n> files.
+ * -fetch_row of the manifest returns rows of parts in order, with enough
+ * threads parts are instead read ahead concurrently and applied one by one.
+ */
+- (void)
+recover_snap_parts:(XLog *)snap
+{
+#ifdef THREADS
+	if (![snap isKindOf:[XLog12 class]] || ((XLog12 *)snap)->part_count == 0)
+		return;
+	if (cfg.snap_read_ahead <= 0 || cfg.snap_read_threads < 2)
+		return;
+
+	XLog12 *manifest = (XLog12 *)snap;
+	int count = manifest->part_count;
+	struct row_v12 *row = [snap fetch_row];
+	if (row == NULL || (row->tag & TAG_MASK) != snap_initial)
+		raise_fmt("snap_initial row is missing");
+	[recovery recover_row:row];
+	lsn = row->lsn;
+
+	int threads = MIN(cfg.snap_read_threads, count);
+	struct read_ahead **ra = xcalloc(count, sizeof(*ra));
+	say_info("loading %i snapshot parts using %i threads", count, threads);
+	@try {
+		for (int i = 0; i < threads; i++)
+			ra[i] = read_ahead_start(open_part(snap, i + 1), cfg.snap_read_ahead, i, false);
+
+		for (int i = 0; i < count; i++) {
+			[self recover_section:ra[i] shard:-1];
+			section_free(ra[i], true);
+			ra[i] = NULL;
+
+			if (i + threads < count)
+				ra[i + threads] = read_ahead_start(open_part(snap, i + threads + 1),
+								   cfg.snap_read_ahead, i % threads, false);
+
+			say_info("%i/%i snapshot parts recovered", i + 1, count);
+			title("loading %.2f%%", 100. * (i + 1) / count);
+		}
+		/* the rest of manifest is read by -recover_row_stream: */
+		manifest->next_part = count + 1;
+	}
+	@finally {
+		for (int i = 0; i < count; i++)
+			if (ra[i])
+				section_free(ra[i], false);
+		free(ra);
+	}
+#else
+	(void)snap;
+#endif
+}
 
 - (i64)
 recover_snap:(XLog *)snap
@@ -135,6 +553,8 @@ recover_snap:(XLog *)snap
 		if (legacy_snap)
 			[recovery recover_row:dummy_row(snap->lsn, snap->lsn, snap_initial|TAG_SYS)];
 
+		[self recover_snap_parts:snap];
+		[self recover_snap_sections:snap];
 		[self recover_row_stream:snap];
 
 		/* old v11 snapshot, scn == lsn from filename */
@@ -150,6 +570,9 @@ recover_snap:(XLog *)snap
 		palloc_cutoff(fiber->pool);
 		[snap free];
 		snap = nil;
+#ifdef THREADS
+		read_ahead_release_readers();
+#endif
 	}
 	say_info("snapshot recovered, LSN:%"PRIi64, lsn);
 	return lsn;
@@ -143,6 +143,11 @@ update_rt (int _shard_id, Shard<Shard>* _shard, const char* _master_name)
 			netmsg_pool_ctx_init (ctx, "proxy_pool", 64*1024);
 		}
 
+#if CFG_iproto_proxy_connections
+		if (cfg.iproto_proxy_connections > 1)
+			route->proxy = iproto_remote_add_peer_pool (addr, ctx, cfg.iproto_proxy_connections);
+		else
+#endif
 		route->proxy = iproto_remote_add_peer (NULL, addr, ctx); // will check for existing connect
 	}
 
@@ -492,8 +497,11 @@ recover_row:(struct row_v12 *)r
 			break;
 		case snap_final:
 			state = snap_final;
-			if ([self shard:0] && [self shard:0]->dummy)
+			if ([self shard:0] && [self shard:0]->dummy) {
 				[[self shard:0] recover_row:r];
+				if ([(id)[[self shard:0] executor] respondsTo:@selector(bulk_build)])
+					[(id)[[self shard:0] executor] bulk_build];
+			}
 			return;
 		case wal_final:
 			assert(false);
@@ -529,6 +537,9 @@ recover_row:(struct row_v12 *)r
 
 		[shard recover_row:r];
 
+		if (tag == shard_final && [(id)[shard executor] respondsTo:@selector(bulk_build)])
+			[(id)[shard executor] bulk_build];
+
 		if (unlikely(fold_scn)) {
 			if (r->scn == fold_scn && (r->tag & ~TAG_MASK) == TAG_WAL) {
 				if ([(id)[shard executor] respondsTo:@selector(snapshot_fold)])
@@ -31,6 +31,8 @@
 #import <tbuf.h>
 #import <paxos.h>
 #import <cfg/defs.h>
+#import <fiber.h>
+#import <thread_pool.h>
 
 
 @implementation Shard
@@ -312,6 +314,38 @@ prepare_remote_row:(struct row_v12 *)row offt:(int)offt
 @end
 
 
+#ifdef THREADS
+@interface IndexSorter: ThreadPool
+@end
+
+@implementation IndexSorter
+- (i64)
+perform_request:(request_arg)arg
+{
+	return [(id)arg.p bulk_sort];
+}
+@end
+
+static IndexSorter *index_sorter;
+#endif
+
+struct bulk_sort {
+	Fiber *fiber;
+	int *pending;
+	i64 res;
+	id error;
+};
+
+static void
+bulk_sorted(request_arg arg, i64 res, id error)
+{
+	struct bulk_sort *s = arg.p;
+	s->res = res;
+	s->error = error;
+	if (--*s->pending == 0)
+		fiber_wake(s->fiber, NULL);
+}
+
 @implementation DefaultExecutor
 - (id)
 init
@@ -345,6 +379,62 @@ print:(const struct row_v12 *)row into:(struct tbuf *)buf
 {
 	tbuf_printf(buf, "%s: row=%p", __func__, row);
 }
+
+- (void)
+bulk_index:(id)index
+{
+	bulk_index = xrealloc(bulk_index, (bulk_index_count + 1) * sizeof(*bulk_index));
+	bulk_index[bulk_index_count++] = index;
+}
+
+- (void)
+bulk_build
+{
+	int count = bulk_index_count, pending = 0;
+	bool sorted = false;
+	if (count == 0)
+		return;
+
+	struct bulk_sort sort[count];
+	memset(sort, 0, sizeof(sort));
+	say_info("shard %i: building %i indexes", shard ? shard->id : 0, count);
+
+#ifdef THREADS
+	if (cfg.index_sort_threads > 0) {
+		if (index_sorter == nil)
+			index_sorter = [[IndexSorter alloc] init_num:cfg.index_sort_threads];
+
+		pending = count;
+		for (int i = 0; i < count; i++) {
+			sort[i].fiber = fiber;
+			sort[i].pending = &pending;
+			[index_sorter send:(request_arg){ .p = bulk_index[i] }
+					cb:bulk_sorted
+				    cb_arg:(request_arg){ .p = &sort[i] }];
+		}
+		while (pending > 0)
+			yield();
+		sorted = true;
+	}
+#endif
+	for (int i = 0; !sorted && i < count; i++)
+		sort[i].res = [bulk_index[i] bulk_sort];
+
+	@try {
+		for (int i = 0; i < count; i++) {
+			if (sort[i].error)
+				@throw sort[i].error;
+			if (!sort[i].res)
+				raise_fmt("duplicate key in unique index %i", i);
+			[bulk_index[i] bulk_commit];
+		}
+	}
+	@finally {
+		free(bulk_index);
+		bulk_index = NULL;
+		bulk_index_count = 0;
+	}
+}
 @end
 
 register_source();
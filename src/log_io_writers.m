@@ -35,6 +35,7 @@
 #import <say.h>
 #import <spawn_child.h>
 #import <shard.h>
+#import <stat.h>
 
 #include <third_party/crc32.h>
 
@@ -46,11 +47,30 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/select.h>
 
 #if HAVE_LINUX_FALLOC_H
 #include <linux/falloc.h>
 #endif
+#if HAVE_LIBURING
+#include <liburing.h>
+#endif
+#ifdef THREADS
+#include <pthread.h>
+#endif
+
 
+#define STAT(_)				\
+	_(WAL_GROUP_REQUESTS, 1)	\
+	_(WAL_GROUP_ROWS, 2)		\
+	_(WAL_FSYNC, 3)			\
+	_(WAL_FSYNC_TIME, 4)		\
+	_(WAL_BATCH_ROWS, 5)		\
+	_(WAL_BATCH_FSYNC_TIME, 6)
+
+enum wal_stat ENUM_INITIALIZER(STAT);
+static char const * const stat_ops[] = ENUM_STR_INITIALIZER(STAT);
+static int stat_base;
 
 struct shard_state {
 	i64 scn, wet_scn;
@@ -62,14 +82,124 @@ struct wal_disk_writer_conf {
 	struct shard_state st[MAX_SHARD];
 };
 
+#ifdef THREADS
+/* pool of empty preallocated WAL files. WAL rotation renames one of them
+   instead of creating and growing new file. pool is refilled by separate
+   thread of WAL writer */
+static struct {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	int count;
+	off_t size;
+	char **filename;
+	bool *ready;
+} spare;
+
+static int
+spare_create(int i)
+{
+	int fd = open(spare.filename[i], O_WRONLY|O_CREAT, 0644);
+	if (fd < 0) {
+		say_syserror("open(%s)", spare.filename[i]);
+		return -1;
+	}
+	int r = 0;
+#if HAVE_FALLOCATE && defined(FALLOC_FL_KEEP_SIZE)
+	r = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, spare.size);
+	if (r < 0)
+		say_syserror("fallocate(%s)", spare.filename[i]);
+#endif
+	if (r == 0 && (r = fsync(fd)) < 0)
+		say_syserror("fsync(%s)", spare.filename[i]);
+	close(fd);
+	return r;
+}
+
+static void *
+spare_fill(void *arg __attribute__((unused)))
+{
+	pthread_mutex_lock(&spare.mtx);
+	for (;;) {
+		int i = 0;
+		while (i < spare.count && spare.ready[i])
+			i++;
+		if (i == spare.count) {
+			pthread_cond_wait(&spare.cond, &spare.mtx);
+			continue;
+		}
+
+		pthread_mutex_unlock(&spare.mtx);
+		int r = spare_create(i);
+		if (r == 0 && fsync(wal_dir->fd) < 0)
+			say_syserror("can't fsync dir");
+		if (r < 0)
+			sleep(1);
+		pthread_mutex_lock(&spare.mtx);
+		spare.ready[i] = r == 0;
+	}
+	return NULL;
+}
+
+static void
+spare_init()
+{
+	pthread_t thread;
+
+	spare.count = cfg.wal_spare_segments;
+	spare.size = (off_t)cfg.wal_spare_segment_size << 20;
+	spare.filename = xcalloc(spare.count, sizeof(*spare.filename));
+	spare.ready = xcalloc(spare.count, sizeof(*spare.ready));
+	for (int i = 0; i < spare.count; i++) {
+		spare.filename[i] = xmalloc(PATH_MAX);
+		snprintf(spare.filename[i], PATH_MAX, "%s/%02i%s.spare",
+			 wal_dir->dirname, i, wal_dir->suffix);
+	}
+
+	pthread_mutex_init(&spare.mtx, NULL);
+	pthread_cond_init(&spare.cond, NULL);
+	if (pthread_create(&thread, NULL, spare_fill, NULL) != 0) {
+		say_syserror("pthread_create");
+		spare.count = 0;
+	}
+}
+
+static XLog *
+spare_open(i64 lsn, i64 *scn)
+{
+	XLog *wal = nil;
+	pthread_mutex_lock(&spare.mtx);
+	for (int i = 0; i < spare.count; i++) {
+		if (!spare.ready[i])
+			continue;
+
+		wal = [wal_dir open_for_write:lsn scn:scn spare:spare.filename[i]];
+		if (wal != nil)
+			wal->alloced = spare.size;
+		spare.ready[i] = false;
+		pthread_cond_signal(&spare.cond);
+		break;
+	}
+	pthread_mutex_unlock(&spare.mtx);
+	return wal;
+}
+#endif
+
 
 @interface WALDiskWriter: Object {
 @public
 	i64 lsn;
 	XLog *current_wal;	/* the WAL we'r currently reading/writing from/to */
 	XLog *wal_to_close;
+	ev_tstamp fsync_time;	/* duration of last fsync, -1 if there were none */
+#if HAVE_LIBURING
+	struct io_uring *ring;
+	ev_tstamp fsync_start;
+	bool fsync_inflight;
+#endif
 }
 - (id) init_conf:(const struct wal_disk_writer_conf *)conf_;
+- (bool) fsync_inflight;
+- (ev_tstamp) fsync_wait;
 @end
 
 
@@ -80,9 +210,74 @@ init_conf:(const struct wal_disk_writer_conf *)conf
 {
 	[self init];
 	lsn = conf->lsn;
+
+	if (cfg.wal_io_uring) {
+#if HAVE_LIBURING
+		ring = xmalloc(sizeof(*ring));
+		int r = io_uring_queue_init(8, ring, 0);
+		if (r < 0) {
+			errno = -r;
+			say_syserror("io_uring_queue_init, falling back to fdatasync");
+			free(ring);
+			ring = NULL;
+		}
+#else
+		say_warn("io_uring is not supported, falling back to fdatasync");
+#endif
+	}
 	return self;
 }
 
+#if HAVE_LIBURING
+- (bool)
+fsync_inflight
+{
+	return fsync_inflight;
+}
+
+- (int)
+fsync_submit
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+	assert(sqe != NULL && !fsync_inflight);
+	io_uring_prep_fsync(sqe, [current_wal fileno], IORING_FSYNC_DATASYNC);
+
+	int r = io_uring_submit(ring);
+	if (r < 0) {
+		errno = -r;
+		return -1;
+	}
+	fsync_start = ev_time();
+	fsync_inflight = true;
+	wal_io_stat_start();
+	return 0;
+}
+
+- (ev_tstamp)
+fsync_wait
+{
+	struct io_uring_cqe *cqe;
+	int r;
+
+	assert(fsync_inflight);
+	while ((r = io_uring_wait_cqe(ring, &cqe)) == -EINTR);
+	if (r < 0) {
+		errno = -r;
+		panic_syserror("io_uring_wait_cqe");
+	}
+	if (cqe->res < 0) {
+		errno = -cqe->res;
+		say_syserror("can't flush wal");
+	}
+	io_uring_cqe_seen(ring, cqe);
+	fsync_inflight = false;
+	return ev_time() - fsync_start;
+}
+#else
+- (bool) fsync_inflight { return false; }
+- (ev_tstamp) fsync_wait { abort(); }
+#endif
+
 - (const struct row_v12 *)
 append_row:(struct row_v12 *)row data:(const void *)data
 {
@@ -98,7 +293,12 @@ prepare_write:(const struct shard_state *)st
 		for (int i = 0; i < MAX_SHARD; i++)
 			scn[i] = st[i].scn ? st[i].scn + 1 : 0;
 
-		current_wal = [wal_dir open_for_write:lsn + 1 scn:scn];
+#ifdef THREADS
+		if (spare.count > 0)
+			current_wal = spare_open(lsn + 1, scn);
+		if (current_wal == nil)
+#endif
+			current_wal = [wal_dir open_for_write:lsn + 1 scn:scn];
 	}
 
         if (current_wal == nil) {
@@ -126,6 +326,7 @@ confirm_write
 {
 	static ev_tstamp last_flush;
 
+	fsync_time = -1;
 	if (current_wal != nil) {
 		i64 confirmed_lsn = [current_wal confirm_write];
 
@@ -150,13 +351,29 @@ confirm_write
 		lsn = confirmed_lsn;
 
 		if (cfg.wal_fsync_delay >= 0 && ev_now() - last_flush >= cfg.wal_fsync_delay) {
+			ev_tstamp start = ev_time();
+#if HAVE_LIBURING
+			/* rows are already written by [confirm_write], so
+			   fdatasync may complete while next group is prepared.
+			   fsync_time is set by [fsync_wait] */
+			if (ring != NULL) {
+				if ([self fsync_submit] < 0)
+					say_syserror("can't flush wal");
+				else
+					last_flush = start;
+			} else
+#endif
 			/* note: [flush] silently drops unwritten rows.
 			   it's ok here because of previous call to [confirm_write] */
+			wal_io_stat_start();
 			if ([current_wal flush] < 0) {
+				wal_io_stat_report(-1);
 				say_syserror("can't flush wal");
 			} else {
 				ev_now_update();
 				last_flush = ev_now();
+				fsync_time = last_flush - start;
+				wal_io_stat_report(fsync_time);
 			}
 		}
 
@@ -213,6 +430,26 @@ static int flush(int fd, const struct request *requests, int count)
 	return 0;
 }
 
+/* replies of a group are delayed until it's fdatasync completes */
+static int
+flush_delayed(WALDiskWriter *writer, int fd, struct tbuf *delayed)
+{
+	struct wal_reply *reply = delayed->ptr;
+	reply->fsync_time = [writer fsync_wait];
+	wal_io_stat_report(reply->fsync_time);
+
+	while (tbuf_len(delayed) > 0) {
+		ssize_t r = write(fd, delayed->ptr, tbuf_len(delayed));
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		tbuf_ltrim(delayed, r);
+	}
+	return 0;
+}
+
 static int
 request_row_count(struct tbuf *rbuf)
 {
@@ -227,6 +464,53 @@ request_row_count(struct tbuf *rbuf)
 	return -1;
 }
 
+/* wait for more requests until group commit thresholds or deadline are hit.
+   returns result of last recv(), i.e. > 0 unless error or EOF happened */
+static ssize_t
+group_commit_recv(struct tbuf *rbuf, int fd)
+{
+	ev_tstamp deadline = ev_time() + cfg.wal_group_commit_delay;
+
+	for (;;) {
+		int requests = 0, rows = 0;
+		const char *ptr = rbuf->ptr;
+		while (ptr + sizeof(u32[2]) <= (const char *)rbuf->end &&
+		       ptr + *(const u32 *)ptr <= (const char *)rbuf->end)
+		{
+			requests++;
+			rows += ((const u32 *)ptr)[1];
+			ptr += *(const u32 *)ptr;
+		}
+
+		if (requests >= BATCH_SIZE ||
+		    (cfg.wal_group_commit_rows > 0 && rows >= cfg.wal_group_commit_rows) ||
+		    (cfg.wal_group_commit_bytes > 0 && tbuf_len(rbuf) >= cfg.wal_group_commit_bytes))
+			return 1;
+
+		ev_tstamp timeout = deadline - ev_time();
+		if (timeout <= 0)
+			return 1;
+
+		fd_set rfds;
+		FD_ZERO(&rfds);
+		FD_SET(fd, &rfds);
+		struct timeval tv = { .tv_sec = (time_t)timeout,
+				      .tv_usec = (timeout - (time_t)timeout) * 1e6 };
+		int n = select(fd + 1, &rfds, NULL, NULL, &tv);
+		if (n < 0 && errno != EINTR)
+			return -1;
+		if (n <= 0)
+			continue;
+
+		tbuf_ensure(rbuf, 16 * 1024);
+		ssize_t r = tbuf_recv(rbuf, fd);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return r;
+	}
+}
+
 static void
 request_parse(struct request *request, int row_count, struct tbuf *rbuf)
 {
@@ -321,6 +605,7 @@ wal_disk_writer(int fd, int cfd __attribute__((unused)), void *state, int len)
 	struct shard_state *st = conf->st;
 	struct request requests[BATCH_SIZE];
 	struct tbuf rbuf = TBUF(NULL, 0, fiber->pool);
+	struct tbuf delayed = TBUF(NULL, 0, fiber->pool);
 	int result = EXIT_FAILURE;
 	i64 start_lsn;
 	ssize_t r;
@@ -331,6 +616,7 @@ wal_disk_writer(int fd, int cfd __attribute__((unused)), void *state, int len)
 
 	ev_tstamp start_time = ev_now();
 	palloc_register_gc_root(fiber->pool, &rbuf, tbuf_gc);
+	palloc_register_gc_root(fiber->pool, &delayed, tbuf_gc);
 
 	say_debug("%s: configured LSN:%"PRIi64, __func__, conf->lsn);
 	for (int i = 0; i < MAX_SHARD; i++)
@@ -345,9 +631,36 @@ wal_disk_writer(int fd, int cfd __attribute__((unused)), void *state, int len)
 	/* ignore SIGUSR1, so accidental miss in 'kill -USR1' won't cause crash */
 	signal(SIGUSR1, SIG_IGN);
 
+	if (cfg.wal_spare_segments > 0) {
+#ifdef THREADS
+		spare_init();
+#else
+		say_warn("wal_spare_segments requires threads, ignored");
+#endif
+	}
+
 	for (;;) {
 		tbuf_ensure(&rbuf, 16 * 1024);
-		r = tbuf_recv(&rbuf, fd);
+		if ([writer fsync_inflight]) {
+			/* prepare next group while previous one is being synced,
+			   but don't wait for it */
+			r = recv(fd, rbuf.end, tbuf_free(&rbuf), MSG_DONTWAIT);
+			if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				if (flush_delayed(writer, fd, &delayed) < 0) {
+					result = EX_OK;
+					goto exit;
+				}
+				continue;
+			}
+			if (r > 0) {
+				rbuf.end += r;
+				rbuf.free -= r;
+			}
+		} else {
+			r = tbuf_recv(&rbuf, fd);
+		}
+		if (r > 0 && cfg.wal_group_commit_delay > 0)
+			r = group_commit_recv(&rbuf, fd);
 		if (r < 0 && (errno == EINTR))
 			continue;
 		else if (r < 0) {
@@ -409,6 +722,11 @@ wal_disk_writer(int fd, int cfd __attribute__((unused)), void *state, int len)
 		if (request_count == 0)
 			continue;
 
+		if ([writer fsync_inflight] && flush_delayed(writer, fd, &delayed) < 0) {
+			result = EX_OK;
+			goto exit;
+		}
+
 		assert(start_lsn > 0);
 		u32 rows_confirmed = [writer confirm_write] - start_lsn;
 		assert(rows_appended >= rows_confirmed);
@@ -416,6 +734,10 @@ wal_disk_writer(int fd, int cfd __attribute__((unused)), void *state, int len)
 		if (rows_appended != rows_confirmed) /* some rows failed to flush */
 			epoch++;
 
+		requests[0].reply->group_requests = request_count;
+		requests[0].reply->group_rows = rows_appended;
+		requests[0].reply->fsync_time = writer->fsync_time;
+
 		for (int i = 0; i < request_count; i++) {
 			struct request *request = &requests[i];
 			struct wal_reply *reply = request->reply;
@@ -443,7 +765,10 @@ wal_disk_writer(int fd, int cfd __attribute__((unused)), void *state, int len)
 				  i, reply->row_count, reply->lsn, reply->scn);
 		}
 
-		if (flush(fd, requests, request_count) < 0) {
+		if ([writer fsync_inflight]) {
+			for (int i = 0; i < request_count; i++)
+				tbuf_append(&delayed, requests[i].reply, requests[i].reply->packet_len);
+		} else if (flush(fd, requests, request_count) < 0) {
 			/* parent is dead, exit quetly */
 			result = EX_OK;
 			goto exit;
@@ -452,6 +777,8 @@ wal_disk_writer(int fd, int cfd __attribute__((unused)), void *state, int len)
 		fiber_gc();
 	}
 exit:
+	if ([writer fsync_inflight])
+		flush_delayed(writer, fd, &delayed);
 	[writer->current_wal free];
 	writer->current_wal = nil;
 	return result;
@@ -517,6 +844,19 @@ wal_disk_writer_input_dispatch(ev_io *ev, int __attribute__((unused)) events)
 		struct wal_reply *reply = rbuf->ptr;
 		assert(pack->seq == reply->seq);
 
+		/* aggregates show distribution over the period,
+		   gauges size and fsync latency of the last batch */
+		if (reply->group_requests > 0) {
+			stat_aggregate_static(stat_base, WAL_GROUP_REQUESTS, reply->group_requests);
+			stat_aggregate_static(stat_base, WAL_GROUP_ROWS, reply->group_rows);
+			stat_gauge_static(stat_base, WAL_BATCH_ROWS, reply->group_rows);
+			if (reply->fsync_time >= 0) {
+				stat_sum_static(stat_base, WAL_FSYNC, 1);
+				stat_aggregate_static(stat_base, WAL_FSYNC_TIME, reply->fsync_time);
+				stat_gauge_static(stat_base, WAL_BATCH_FSYNC_TIME, reply->fsync_time);
+			}
+		}
+
 		if (reply->row_count > 0) /* success or partial success */
 			resume(pack->fiber, reply);
 
@@ -590,6 +930,7 @@ init_lsn:(i64)init_lsn
 			say_info("\tShard:%i SCN:%"PRIi64, i, conf->st[i].scn);
 	}
 	wal_writer = spawn_child("wal_writer", wal_disk_writer, nil, -1, conf, sizeof(*conf));
+	stat_base = stat_register_static("wal_writer", stat_ops, nelem(stat_ops));
 	if (wal_writer.pid < 0)
 		panic("unable to start WAL writer");
 	io = [netmsg_io alloc];
@@ -671,7 +1012,9 @@ wal_pack_append_data(struct wal_pack *pack, const void *data, size_t len)
 wal_pack_submit
 {
 	struct wal_pack *pack = TAILQ_LAST(&wal_queue, wal_pack_tailq);
+	fiber_trace(IPROTO_TRACE_WAL_SUBMIT);
 	struct wal_reply *reply = yield();
+	fiber_trace(IPROTO_TRACE_WAL_DONE);
 	if (reply->row_count == 0)
 		say_warn("WAL writer returned error status");
 	else
@@ -683,6 +1026,169 @@ wal_pack_submit
 }
 @end
 
+#ifdef THREADS
+/* rows of a part file, struct row_v12 followed by data one after another */
+struct snap_chunk {
+	struct snap_chunk *next;
+	int shard_id; /* section of that shard starts here, -1 if none */
+	size_t len, size;
+	char data[];
+};
+
+struct snap_part;
+
+/* collects rows of a snapshot part in memory and queues them
+   to the thread writing that part */
+@interface SnapSpool: XLog {
+	struct snap_part *part;
+	struct snap_chunk *chunk;
+}
+- (id) init_part:(struct snap_part *)part;
+- (int) mark_section:(int)shard_id;
+@end
+
+struct snap_part {
+	i64 lsn;
+	int part, parts;
+	int result;
+	pthread_t thread;
+	SnapSpool *spool;
+
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	struct snap_chunk *head, **tail;
+	size_t queued;
+	bool closed, failed;
+
+	char filename[PATH_MAX]; /* .inprogress until renamed */
+	bool renamed;
+	i64 scn[MAX_SHARD]; /* header of the part file */
+};
+
+enum { SNAP_CHUNK_SIZE = 256 * 1024, SNAP_PART_QUEUE = 16 * SNAP_CHUNK_SIZE };
+
+static int
+snap_part_push(struct snap_part *p, struct snap_chunk *c)
+{
+	pthread_mutex_lock(&p->mtx);
+	while (p->queued > SNAP_PART_QUEUE && !p->failed)
+		pthread_cond_wait(&p->cond, &p->mtx);
+	bool failed = p->failed;
+	if (!failed) {
+		c->next = NULL;
+		*p->tail = c;
+		p->tail = &c->next;
+		p->queued += c->len;
+		pthread_cond_signal(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mtx);
+	if (failed)
+		free(c);
+	return failed ? -1 : 0;
+}
+
+/* NULL when the queue is closed and empty */
+static struct snap_chunk *
+snap_part_pop(struct snap_part *p)
+{
+	pthread_mutex_lock(&p->mtx);
+	while (p->head == NULL && !p->closed)
+		pthread_cond_wait(&p->cond, &p->mtx);
+	struct snap_chunk *c = p->head;
+	if (c != NULL) {
+		if ((p->head = c->next) == NULL)
+			p->tail = &p->head;
+		p->queued -= c->len;
+		pthread_cond_signal(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mtx);
+	return c;
+}
+
+static void
+snap_part_close(struct snap_part *p)
+{
+	pthread_mutex_lock(&p->mtx);
+	p->closed = true;
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->mtx);
+}
+
+static void
+snap_part_fail(struct snap_part *p)
+{
+	pthread_mutex_lock(&p->mtx);
+	p->failed = true;
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->mtx);
+}
+
+static struct snap_chunk *
+snap_chunk_alloc(int shard_id, size_t len)
+{
+	size_t size = MAX(len, SNAP_CHUNK_SIZE);
+	struct snap_chunk *c = xmalloc(sizeof(*c) + size);
+	c->next = NULL;
+	c->shard_id = shard_id;
+	c->len = 0;
+	c->size = size;
+	return c;
+}
+
+@implementation SnapSpool
+- (id)
+init_part:(struct snap_part *)part_
+{
+	[self init];
+	part = part_;
+	mode = LOG_WRITE;
+	return self;
+}
+
+- (id)
+free
+{
+	free(chunk);
+	return [super free];
+}
+
+- (const struct row_v12 *)
+append_row:(struct row_v12 *)row data:(const void *)data
+{
+	size_t len = sizeof(*row) + row->len;
+	if (chunk != NULL && chunk->len + len > chunk->size && [self flush] < 0)
+		return NULL;
+	if (chunk == NULL)
+		chunk = snap_chunk_alloc(-1, len);
+
+	memcpy(chunk->data + chunk->len, row, sizeof(*row));
+	memcpy(chunk->data + chunk->len + sizeof(*row), data, row->len);
+	chunk->len += len;
+	rows++;
+	return row;
+}
+
+- (int)
+mark_section:(int)shard_id
+{
+	if ([self flush] < 0)
+		return -1;
+	chunk = snap_chunk_alloc(shard_id, 0);
+	return 0;
+}
+
+- (int)
+flush
+{
+	if (chunk == NULL)
+		return 0;
+	struct snap_chunk *c = chunk;
+	chunk = NULL;
+	return snap_part_push(part, c);
+}
+@end
+#endif
+
 @implementation SnapWriter
 
 - (id)
@@ -693,6 +1199,212 @@ init_state:(id<RecoveryState>)state_
 	return self;
 }
 
+static int
+write_section(XLog *snap, int shard_id, Shard<Shard> *shard)
+{
+	if ([snap mark_section:shard_id] < 0)
+		return -1;
+
+	if ([shard snapshot_write_header:snap] == NULL)
+	{
+		say_error("unable write initial row");
+		return -1;
+	}
+
+	if ([[shard executor] snapshot_write_rows:snap] < 0)
+		return -1;
+
+	char dummy[2] = { 0 };
+	if ([snap append_row:dummy len:sizeof(dummy)
+		       shard:shard tag:shard_final|TAG_SYS] == NULL)
+		return -1;
+	return 0;
+}
+
+#ifdef THREADS
+static int
+write_chunk(XLog *snap, struct snap_chunk *c)
+{
+	if (c->shard_id >= 0 && [snap mark_section:c->shard_id] < 0)
+		return -1;
+
+	for (size_t off = 0; off < c->len;) {
+		struct row_v12 *row = (struct row_v12 *)(c->data + off);
+		off += sizeof(*row) + row->len;
+		if ([snap append_row:row data:row->data] == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+write_part(struct snap_part *p, XLog *snap)
+{
+	struct snap_chunk *c;
+	while ((c = snap_part_pop(p)) != NULL) {
+		int r = write_chunk(snap, c);
+		free(c);
+		if (r < 0)
+			return -1;
+	}
+
+	if ([snap mark_section:-1] < 0)
+		return -1;
+
+	if ([snap write_section_index] < 0) {
+		say_error("unable write section index");
+		return -1;
+	}
+
+	if ([snap write_eof_marker] == -1) {
+		say_syserror("snap part close failed");
+		return -1;
+	}
+	return 0;
+}
+
+static void *
+snap_part_thread(void *arg)
+{
+	struct snap_part *p = arg;
+	struct snap_chunk *c;
+	char name[32];
+	snprintf(name, sizeof(name), "dumper/part%i", p->part);
+	fiber_create_fake(name);
+
+	p->result = -1;
+	XLog *snap = [snap_dir open_for_write:p->lsn scn:p->scn part:p->part of:p->parts];
+	if (snap == nil) {
+		say_syserror("can't open snap part for writing");
+	} else {
+		snap->no_wet = true;
+		strncpy(p->filename, snap->filename, sizeof(p->filename) - 1);
+
+		@try {
+			p->result = write_part(p, snap);
+		}
+		@catch (Error *e) {
+			say_error("unable write snap part: %s", e->reason);
+		}
+		@finally {
+			[snap free];
+		}
+	}
+
+	if (p->result < 0) {
+		/* dumper gets an error on next push and closes the queue */
+		snap_part_fail(p);
+		while ((c = snap_part_pop(p)) != NULL)
+			free(c);
+	}
+	fiber_destroy_fake();
+	return NULL;
+}
+
+static void
+remove_parts(struct snap_part *part, int parts)
+{
+	for (int i = 0; i < parts; i++) {
+		if (part[i].filename[0] == 0)
+			continue;
+		if (part[i].renamed)
+			*strrchr(part[i].filename, '.') = 0;
+		unlink(part[i].filename);
+	}
+}
+
+/* parts are complete: give them final names before manifest gets its one */
+static int
+rename_parts(struct snap_part *part, int parts)
+{
+	for (int i = 0; i < parts; i++) {
+		char final_filename[PATH_MAX];
+		strcpy(final_filename, part[i].filename);
+		*strrchr(final_filename, '.') = 0;
+		if (rename(part[i].filename, final_filename) != 0) {
+			say_syserror("can't rename %s to %s", part[i].filename, final_filename);
+			return -1;
+		}
+		part[i].renamed = true;
+	}
+	if ([snap_dir sync] < 0) {
+		say_syserror("can't fsync dir");
+		return -1;
+	}
+	return 0;
+}
+
+/* shards are distributed among parts round robin. Rows are produced here,
+   by the dumper, one shard after another: executors aren't required to be
+   thread safe. Each part is checksummed, compressed and written by its own
+   thread into <lsn>.snap.<n>.inprogress */
+static struct snap_part *
+write_parts(id<RecoveryState> state, int parts)
+{
+	struct snap_part *part = p0alloc(fiber->pool, parts * sizeof(*part));
+	int result = 0, started = 0, j = 0;
+
+	for (int i = 0; i < MAX_SHARD; i++) {
+		Shard<Shard> *shard = [state shard:i];
+		if (shard == nil)
+			continue;
+		part[j % parts].scn[i] = [shard scn];
+		j++;
+	}
+
+	for (int i = 0; i < parts; i++) {
+		struct snap_part *p = &part[i];
+		p->lsn = [state lsn];
+		p->part = i + 1;
+		p->parts = parts;
+		p->tail = &p->head;
+		pthread_mutex_init(&p->mtx, NULL);
+		pthread_cond_init(&p->cond, NULL);
+		p->spool = [[SnapSpool alloc] init_part:p];
+	}
+
+	for (; started < parts; started++) {
+		if (pthread_create(&part[started].thread, NULL, snap_part_thread, &part[started]) != 0) {
+			say_syserror("pthread_create");
+			result = -1;
+			break;
+		}
+	}
+
+	@try {
+		j = 0;
+		for (int i = 0; result == 0 && i < MAX_SHARD; i++) {
+			Shard<Shard> *shard = [state shard:i];
+			if (shard == nil)
+				continue;
+			if (write_section(part[j++ % parts].spool, i, shard) < 0)
+				result = -1;
+		}
+		for (int i = 0; result == 0 && i < parts; i++)
+			if ([part[i].spool flush] < 0)
+				result = -1;
+	}
+	@finally {
+		for (int i = 0; i < started; i++) {
+			snap_part_close(&part[i]);
+			pthread_join(part[i].thread, NULL);
+			if (part[i].result < 0)
+				result = -1;
+		}
+		for (int i = 0; i < parts; i++) {
+			[part[i].spool free];
+			pthread_cond_destroy(&part[i].cond);
+			pthread_mutex_destroy(&part[i].mtx);
+		}
+	}
+
+	if (result < 0) {
+		remove_parts(part, started);
+		return NULL;
+	}
+	return part;
+}
+#endif
 
 - (int)
 snapshot_write
@@ -707,6 +1419,10 @@ snapshot_write
 	if ([state lsn] < 0)
 		return -1;
 
+	int shards = 0, parts = 0;
+#ifdef THREADS
+	struct snap_part *part = NULL;
+#endif
 	scn = xcalloc(MAX_SHARD, sizeof(*scn));
 	for (int i = 0; i < MAX_SHARD; i++) {
 		Shard<Shard> *shard = [state shard:i];
@@ -717,9 +1433,19 @@ snapshot_write
 
 		scn[i] = [shard scn];
 		total_rows += [[shard executor] snapshot_estimate];
+		shards++;
 	}
 
-	snap = [snap_dir open_for_write:[state lsn] scn:scn];
+#ifdef THREADS
+	if (cfg.snap_parts > 1)
+		[snap_dir remove_orphan_parts];
+	if (!legacy_mode && cfg.snap_parts > 1 && shards > 1)
+		parts = MIN(cfg.snap_parts, shards);
+#endif
+	if (parts > 0)
+		snap = [snap_dir open_for_write:[state lsn] scn:scn part:0 of:parts];
+	else
+		snap = [snap_dir open_for_write:[state lsn] scn:scn];
 	if (snap == nil) {
 		say_syserror("can't open snap for writing");
 		return -1;
@@ -781,25 +1507,23 @@ snapshot_write
 			return -1;
 		}
 
-		for (int i = 0; i < MAX_SHARD; i++) {
-			Shard<Shard> *shard = [state shard:i];
-			if (shard == nil)
-				continue;
-
-			if ([shard snapshot_write_header:snap] == NULL)
-			{
-				say_error("unable write initial row");
-				return -1;
-			}
-
-			if ([[shard executor] snapshot_write_rows:snap] < 0)
+#ifdef THREADS
+		if (parts > 0) {
+			say_info("writing %i shards into %i parts", shards, parts);
+			/* parts are left behind if manifest fails later,
+			   -remove_orphan_parts deletes them */
+			if ((part = write_parts(state, parts)) == NULL)
 				return -1;
-
-			char dummy[2] = { 0 };
-			if ([snap append_row:dummy len:sizeof(dummy)
-				       shard:shard tag:shard_final|TAG_SYS] == NULL)
+		}
+#endif
+		for (int i = 0; parts == 0 && i < MAX_SHARD; i++) {
+			Shard<Shard> *shard = [state shard:i];
+			if (shard != nil && write_section(snap, i, shard) < 0)
 				return -1;
 		}
+
+		if ([snap mark_section:-1] < 0)
+			return -1;
 	}
 
 	const char end[] = "END";
@@ -808,6 +1532,11 @@ snapshot_write
 		return -1;
 	}
 
+	if (!legacy_mode && [snap write_section_index] < 0) {
+		say_error("unable write section index");
+		return -1;
+	}
+
 	if ([snap rows] == 0) /* initial snapshot in compat mode has no rows */
 		[snap append_successful:1]; /* -[XLog close] won't rename empty .inprogress, trick it */
 
@@ -821,6 +1550,11 @@ snapshot_write
 		return -1;
 	}
 
+#ifdef THREADS
+	if (part != NULL && rename_parts(part, parts) < 0)
+		return -1;
+#endif
+
 	if ([snap inprogress_rename] == -1) {
 		say_syserror("snap inprogress rename failed");
 		return -1;
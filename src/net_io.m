@@ -48,6 +48,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#if HAVE_LIBURING && HAVE_DECL_IO_URING_SETUP_BUF_RING && HAVE_DECL_IO_URING_PREP_RECV_MULTISHOT
+#define NET_URING 1
+#include <liburing.h>
+#include <sys/eventfd.h>
+#endif
+
 #if HAVE_VALGRIND_VALGRIND_H && !defined(NVALGRIND)
 # include <valgrind/valgrind.h>
 # include <valgrind/memcheck.h>
@@ -71,6 +77,8 @@ netmsg_pool_ctx_init(struct netmsg_pool_ctx *ctx, const char *name, int limit)
 					   .ctx = (void *)(uintptr_t)1 };
 	ctx->pool = palloc_create_pool(ctx->cfg);
 	ctx->limit = limit;
+	ctx->rchunk_size = 0;
+	ctx->rchunk = ctx->rchunk_spare = NULL;
 }
 
 /* HACK WARNING: palloc_ctx() is used as integer counter */
@@ -225,6 +233,20 @@ netmsg_reset(struct netmsg_head *h)
 		netmsg_dealloc(&h->q, m);
 }
 
+/* copy pending data into buf, which must hold h->bytes, and drop it */
+void
+netmsg_flatten(struct netmsg_head *h, void *buf)
+{
+	struct netmsg *m;
+	TAILQ_FOREACH_REVERSE(m, &h->q, netmsg_tailq, link) {
+		for (int i = 0; i < m->count; i++) {
+			memcpy(buf, m->iov[i].iov_base, m->iov[i].iov_len);
+			buf += m->iov[i].iov_len;
+		}
+	}
+	netmsg_reset(h);
+}
+
 struct netmsg *
 netmsg_concat(struct netmsg_head *dst, struct netmsg_head *src)
 {
@@ -232,6 +254,7 @@ netmsg_concat(struct netmsg_head *dst, struct netmsg_head *src)
 	TAILQ_CONCAT(&dst->q, &src->q, link);
 	dst->bytes += src->bytes;
 	src->bytes = 0;
+	src->last_used_iov = &dummy;
 	TAILQ_INIT(&src->q);
 	return TAILQ_FIRST(&dst->q);
 }
@@ -348,9 +371,111 @@ rbuf_len(const struct netmsg_io *io)
 	return tbuf_len(&io->rbuf);
 }
 
+/* Shared receive buffer. Connections of a ctx receive one after another
+   into the current chunk, rbuf of a connection is a refcounted slice of it.
+   Idle connection holds no buffer at all. Partially received request is
+   extended in place if nobody received after it, otherwise only its
+   bytes are moved to the current chunk. Requests which don't fit into
+   a chunk are received into a private palloc buffer. */
+struct rbuf_chunk {
+	struct netmsg_pool_ctx *ctx;
+	int ref, used;
+	char data[];
+};
+
+void
+netmsg_pool_ctx_shared_rbuf(struct netmsg_pool_ctx *ctx, int chunk_size)
+{
+	ctx->rchunk_size = chunk_size;
+}
+
+static struct rbuf_chunk *
+rbuf_chunk_alloc(struct netmsg_pool_ctx *ctx)
+{
+	struct rbuf_chunk *c = ctx->rchunk_spare;
+	if (c != NULL)
+		ctx->rchunk_spare = NULL;
+	else
+		c = xmalloc(sizeof(*c) + ctx->rchunk_size);
+	c->ctx = ctx;
+	c->ref = 1;
+	c->used = 0;
+	return c;
+}
+
+static void
+rbuf_chunk_unref(struct rbuf_chunk *c)
+{
+	if (--c->ref > 0)
+		return;
+	if (c->ctx->rchunk_spare == NULL)
+		c->ctx->rchunk_spare = c;
+	else
+		free(c);
+}
+
+/* make room for size bytes after rbuf in the current chunk */
+static bool
+rbuf_chunk_ensure(struct netmsg_io *io, int size)
+{
+	struct netmsg_pool_ctx *ctx = io->ctx;
+	struct rbuf_chunk *c = ctx->rchunk;
+	int len = rbuf_len(io);
+
+	if (len + size > ctx->rchunk_size)
+		return false;
+
+	if (c != NULL && io->rchunk == c && io->rbuf.end == c->data + c->used &&
+	    ctx->rchunk_size - c->used >= size)
+	{
+		io->rbuf.free = ctx->rchunk_size - c->used;
+		return true;
+	}
+
+	if (c == NULL || ctx->rchunk_size - c->used < len + size) {
+		if (c != NULL)
+			rbuf_chunk_unref(c);
+		c = ctx->rchunk = rbuf_chunk_alloc(ctx);
+	}
+
+	char *ptr = c->data + c->used;
+	if (len > 0)
+		memcpy(ptr, io->rbuf.ptr, len);
+	c->used += len;
+	c->ref++;
+	if (io->rchunk != NULL)
+		rbuf_chunk_unref(io->rchunk);
+	io->rchunk = c;
+	io->rbuf = (struct tbuf){ .ptr = ptr, .end = ptr + len,
+				  .free = ctx->rchunk_size - c->used };
+	return true;
+}
+
+/* account received bytes in the chunk, drop empty slice */
+static void
+rbuf_chunk_commit(struct netmsg_io *io)
+{
+	struct rbuf_chunk *c = io->rchunk;
+	if (c == NULL)
+		return;
+	if (rbuf_len(io) == 0) {
+		io->rchunk = NULL;
+		io->rbuf = TBUF(NULL, 0, NULL);
+		rbuf_chunk_unref(c);
+		return;
+	}
+	c->used = (char *)io->rbuf.end - c->data;
+	io->rbuf.free = 0;
+}
+
 void
 rbuf_reset(struct netmsg_io *io)
 {
+	if (io->rchunk) {
+		rbuf_chunk_unref(io->rchunk);
+		io->rchunk = NULL;
+		io->rbuf = TBUF(NULL, 0, NULL);
+	}
 	if (io->rbuf.pool) {
 		palloc_unref(io->rbuf.pool);
 		io->rbuf = TBUF(NULL, 0, NULL);
@@ -363,10 +488,8 @@ void
 rbuf_ltrim(struct netmsg_io *io, int size)
 {
 	tbuf_ltrim(&io->rbuf, size);
-	if (tbuf_len(&io->rbuf) == 0) {
-		palloc_unref(io->rbuf.pool);
-		io->rbuf = TBUF(NULL, 0, NULL);
-	}
+	if (tbuf_len(&io->rbuf) == 0)
+		rbuf_reset(io);
 }
 
 void
@@ -383,9 +506,25 @@ rbuf_alloc(struct netmsg_io *io, int size)
 	palloc_ref(pool);
 }
 
-ssize_t
-rbuf_recv(struct netmsg_io *io, int size)
-{
+static void
+rbuf_ensure(struct netmsg_io *io, int size)
+{
+	if (io->rchunk != NULL || (io->rbuf.pool == NULL && io->ctx->rchunk_size > 0)) {
+		if (rbuf_chunk_ensure(io, size))
+			return;
+		if (io->rchunk != NULL) {
+			/* oversize request, continue in private buffer */
+			struct rbuf_chunk *c = io->rchunk;
+			int len = rbuf_len(io);
+			char *ptr = io->rbuf.ptr;
+			io->rchunk = NULL;
+			rbuf_alloc(io, size * 2 + len);
+			tbuf_append(&io->rbuf, ptr, len);
+			rbuf_chunk_unref(c);
+			return;
+		}
+	}
+
 	if (io->rbuf.pool == NULL) {
 		rbuf_alloc(io, size * 2);
 	} else if (tbuf_free(&io->rbuf) < size) {
@@ -400,7 +539,29 @@ rbuf_recv(struct netmsg_io *io, int size)
 			palloc_unref(pool);
 		}
 	}
-	return tbuf_recv(&io->rbuf, io->fd);
+}
+
+ssize_t
+rbuf_recv(struct netmsg_io *io, int size)
+{
+	rbuf_ensure(io, size);
+	ssize_t r = tbuf_recv(&io->rbuf, io->fd);
+	int saved_errno = errno;
+	rbuf_chunk_commit(io);
+	errno = saved_errno;
+	return r;
+}
+
+void
+rbuf_append(struct netmsg_io *io, const void *data, int len)
+{
+	rbuf_ensure(io, len);
+	/* not tbuf_append(): it wants room for trailing NUL, and
+	   a chunk may have exactly len bytes left */
+	memcpy(io->rbuf.end, data, len);
+	io->rbuf.end += len;
+	io->rbuf.free -= len;
+	rbuf_chunk_commit(io);
 }
 
 static struct iovec *
@@ -481,6 +642,487 @@ netmsg_writev(int fd, struct netmsg_head *head)
 	return result;
 }
 
+/* drop first bytes of h, which were already sent by other means */
+void
+netmsg_drop(struct netmsg_head *h, size_t bytes)
+{
+	h->bytes -= bytes;
+	if (h->bytes == 0) {
+		netmsg_reset(h);
+		return;
+	}
+
+	struct netmsg *m = TAILQ_LAST(&h->q, netmsg_tailq), *prev;
+	for (;;) {
+		size_t len = 0;
+		for (int i = 0; i < m->count; i++)
+			len += m->iov[i].iov_len;
+		if (bytes < len)
+			break;
+		bytes -= len;
+		prev = TAILQ_PREV(m, netmsg_tailq, link);
+		netmsg_dealloc(&h->q, m);
+		m = prev;
+	}
+
+	int count = 0;
+	while (count < m->count && bytes >= m->iov[count].iov_len)
+		bytes -= m->iov[count++].iov_len;
+	if (count)
+		netmsg_releasel(m, count);
+	if (bytes) {
+		m->iov[0].iov_base += bytes;
+		m->iov[0].iov_len -= bytes;
+	}
+}
+
+#if NET_URING
+/*
+ * io_uring transport for netmsg_io.
+ *
+ * One ring per process. Input uses multishot recv into a provided buffer
+ * ring, data is appended to io->rbuf and the buffer is recycled at once.
+ * Output is a single writev (or sendmsg_zc for large replies referencing
+ * objects) in flight per connection; the sent part is dropped from wbuf on
+ * completion. SQEs are accumulated and submitted by netmsg_uring_submit(),
+ * i.e. once per event loop iteration.
+ *
+ * Every in-flight operation holds a reference to its netmsg_io.
+ */
+
+#define URING_ENTRIES	1024
+#define URING_BUFS	512 /* power of two */
+#define URING_BUF_SIZE	16384
+#define URING_BGID	1
+
+static struct {
+	struct io_uring ring;
+	struct io_uring_buf_ring *br;
+	char *bufs;
+	ev_io ev;
+	int state; /* 0 : uninitialized, 1 : ok, -1 : unavailable */
+	int writes; /* write SQEs queued since last submit */
+} uring;
+
+enum netmsg_uring_op_type { URING_RECV = 1, URING_WRITE, URING_SEND_ZC };
+struct netmsg_uring_op {
+	enum netmsg_uring_op_type type;
+	struct netmsg_io *io;
+};
+
+struct netmsg_uring {
+	struct netmsg_uring_op recv, write;
+	bool recv_armed, recv_wanted, recv_cancel, write_busy;
+	struct iovec *iov;
+	int iov_size;
+	size_t zc_left; /* sendmsg_zc bytes in flight, they are not in wbuf */
+};
+
+struct netmsg_uring_zc {
+	struct netmsg_uring_op op;
+	struct netmsg_head held; /* buffers must live until kernel notification */
+	struct msghdr msg;
+	struct iovec *iov;
+	int iovcnt, pos, notif;
+	size_t left;
+};
+
+static struct io_uring_sqe *
+uring_sqe(void)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&uring.ring);
+	if (sqe == NULL) {
+		io_uring_submit(&uring.ring);
+		uring.writes = 0;
+		sqe = io_uring_get_sqe(&uring.ring);
+		assert(sqe != NULL);
+	}
+	return sqe;
+}
+
+static void
+uring_cancel(struct netmsg_uring_op *op)
+{
+	struct io_uring_sqe *sqe = uring_sqe();
+	io_uring_prep_cancel(sqe, op, 0);
+	io_uring_sqe_set_data(sqe, NULL);
+}
+
+static void
+uring_recv_arm(struct netmsg_io *io)
+{
+	struct netmsg_uring *u = io->uring;
+	struct io_uring_sqe *sqe = uring_sqe();
+	io_uring_prep_recv_multishot(sqe, io->fd, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	io_uring_sqe_set_data(sqe, &u->recv);
+	u->recv_armed = true;
+	netmsg_io_retain(io);
+}
+
+static void
+uring_recv_done(struct netmsg_io *io, struct io_uring_cqe *cqe)
+{
+	struct netmsg_uring *u = io->uring;
+	bool more = cqe->flags & IORING_CQE_F_MORE;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		char *buf = uring.bufs + bid * URING_BUF_SIZE;
+		if (cqe->res > 0 && io->fd >= 0)
+			rbuf_append(io, buf, cqe->res);
+		io_uring_buf_ring_add(uring.br, buf, URING_BUF_SIZE, bid,
+				      io_uring_buf_ring_mask(URING_BUFS), 0);
+		io_uring_buf_ring_advance(uring.br, 1);
+	}
+	if (!more)
+		u->recv_armed = u->recv_cancel = false;
+
+	if (io->fd < 0)
+		goto out;
+
+	if (cqe->res > 0) {
+		[io data_ready];
+	} else if (cqe->res == 0) {
+		say_debug("peer %s [%i] closed connection", net_fd_name(io->fd), io->fd);
+		[io close];
+	} else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+		errno = -cqe->res;
+		say_syswarn("recv(%i) from %s failed", io->fd, net_fd_name(io->fd));
+		[io close];
+	}
+
+	if (io->fd >= 0 && u->recv_wanted && !u->recv_armed)
+		uring_recv_arm(io);
+out:
+	if (!more)
+		netmsg_io_release(io);
+}
+
+static void
+uring_write_done(struct netmsg_io *io, struct io_uring_cqe *cqe)
+{
+	struct netmsg_uring *u = io->uring;
+	u->write_busy = false;
+	if (cqe->res > 0)
+		netmsg_drop(&io->wbuf, cqe->res);
+
+	if (io->fd >= 0) {
+		if (cqe->res < 0 && cqe->res != -ECANCELED) {
+			errno = -cqe->res;
+			say_syswarn("writev(%i) to %s failed", io->fd, net_fd_name(io->fd));
+			[io close];
+		} else {
+			[io uring_written:cqe->res];
+		}
+	}
+	netmsg_io_release(io);
+}
+
+#if HAVE_DECL_IO_URING_PREP_SENDMSG_ZC
+static bool
+netmsg_has_refs(struct netmsg_head *h)
+{
+	struct netmsg *m;
+	TAILQ_FOREACH(m, &h->q, link)
+		for (int i = 0; i < m->count; i++)
+			if (m->ref[i] != 0)
+				return true;
+	return false;
+}
+
+static void
+uring_zc_submit(struct netmsg_uring_zc *zc)
+{
+	struct io_uring_sqe *sqe = uring_sqe();
+	zc->msg = (struct msghdr){ .msg_iov = zc->iov + zc->pos,
+				   .msg_iovlen = MIN(zc->iovcnt - zc->pos, IOV_MAX) };
+	io_uring_prep_sendmsg_zc(sqe, zc->op.io->fd, &zc->msg, MSG_NOSIGNAL);
+	io_uring_sqe_set_data(sqe, &zc->op);
+	uring.writes++;
+}
+
+static void
+uring_send_zc(struct netmsg_io *io)
+{
+	struct netmsg_uring_zc *zc = xcalloc(1, sizeof(*zc));
+	struct netmsg *m;
+
+	zc->op = (struct netmsg_uring_op){ .type = URING_SEND_ZC, .io = io };
+	netmsg_head_init(&zc->held, io->wbuf.ctx);
+	netmsg_concat(&zc->held, &io->wbuf);
+	zc->left = zc->held.bytes;
+
+	TAILQ_FOREACH(m, &zc->held.q, link)
+		zc->iovcnt += m->count;
+	zc->iov = xmalloc(zc->iovcnt * sizeof(*zc->iov));
+	struct iovec *v = zc->iov;
+	TAILQ_FOREACH_REVERSE(m, &zc->held.q, netmsg_tailq, link) {
+		memcpy(v, m->iov, m->count * sizeof(*v));
+		v += m->count;
+	}
+
+	io->uring->write_busy = true;
+	io->uring->zc_left = zc->left;
+	netmsg_io_retain(io);
+	uring_zc_submit(zc);
+}
+
+static void
+uring_zc_free(struct netmsg_uring_zc *zc)
+{
+	struct netmsg_io *io = zc->op.io;
+	netmsg_reset(&zc->held);
+	free(zc->iov);
+	free(zc);
+	netmsg_io_release(io);
+}
+
+static void
+uring_zc_done(struct netmsg_uring_zc *zc, struct io_uring_cqe *cqe)
+{
+	struct netmsg_io *io = zc->op.io;
+
+	if (cqe->flags & IORING_CQE_F_NOTIF) {
+		if (--zc->notif == 0 && zc->left == 0)
+			uring_zc_free(zc);
+		return;
+	}
+
+	if (cqe->flags & IORING_CQE_F_MORE)
+		zc->notif++;
+
+	ssize_t r = cqe->res;
+	if (r > 0) {
+		zc->left -= r;
+		io->uring->zc_left = zc->left;
+		while (r > 0 && r >= zc->iov[zc->pos].iov_len)
+			r -= zc->iov[zc->pos++].iov_len;
+		if (r > 0) {
+			zc->iov[zc->pos].iov_base += r;
+			zc->iov[zc->pos].iov_len -= r;
+		}
+		if (zc->left > 0 && io->fd >= 0) {
+			uring_zc_submit(zc);
+			return;
+		}
+	}
+
+	io->uring->write_busy = false;
+	io->uring->zc_left = 0;
+	if (io->fd >= 0) {
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			say_syswarn("sendmsg_zc(%i) to %s failed", io->fd, net_fd_name(io->fd));
+			[io close];
+		} else {
+			[io uring_written:cqe->res];
+		}
+	}
+	zc->left = 0; /* the rest is abandoned on error */
+	if (zc->notif == 0)
+		uring_zc_free(zc);
+}
+#endif
+
+static void
+uring_reap_cb(ev_io *ev, int events _unused_)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, count = 0;
+	u64 v;
+
+	while (read(ev->fd, &v, sizeof(v)) < 0 && errno == EINTR);
+
+	io_uring_for_each_cqe(&uring.ring, head, cqe) {
+		struct netmsg_uring_op *op = io_uring_cqe_get_data(cqe);
+		count++;
+		if (op == NULL) /* cancel request */
+			continue;
+		switch (op->type) {
+		case URING_RECV:
+			uring_recv_done(op->io, cqe);
+			break;
+		case URING_WRITE:
+			uring_write_done(op->io, cqe);
+			break;
+		case URING_SEND_ZC:
+#if HAVE_DECL_IO_URING_PREP_SENDMSG_ZC
+			uring_zc_done(container_of(op, struct netmsg_uring_zc, op), cqe);
+#endif
+			break;
+		}
+	}
+	io_uring_cq_advance(&uring.ring, count);
+
+	/* re-armed receives */
+	netmsg_uring_submit(NULL);
+}
+
+static int
+uring_init(void)
+{
+	if (uring.state != 0)
+		return uring.state;
+	uring.state = -1;
+
+	int r = io_uring_queue_init(URING_ENTRIES, &uring.ring, 0);
+	if (r < 0) {
+		errno = -r;
+		say_syserror("io_uring_queue_init");
+		return -1;
+	}
+
+	uring.br = io_uring_setup_buf_ring(&uring.ring, URING_BUFS, URING_BGID, 0, &r);
+	if (uring.br == NULL) {
+		errno = -r;
+		say_syserror("io_uring_setup_buf_ring");
+		goto error;
+	}
+	uring.bufs = xmalloc(URING_BUFS * URING_BUF_SIZE);
+	for (int i = 0; i < URING_BUFS; i++)
+		io_uring_buf_ring_add(uring.br, uring.bufs + i * URING_BUF_SIZE, URING_BUF_SIZE,
+				      i, io_uring_buf_ring_mask(URING_BUFS), i);
+	io_uring_buf_ring_advance(uring.br, URING_BUFS);
+
+	int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0 || io_uring_register_eventfd(&uring.ring, efd) < 0) {
+		say_syserror("eventfd");
+		goto error;
+	}
+	ev_io_init(&uring.ev, uring_reap_cb, efd, EV_READ);
+	ev_io_start(&uring.ev);
+
+	say_info("netmsg_io: io_uring transport initialized");
+	return uring.state = 1;
+error:
+	io_uring_queue_exit(&uring.ring);
+	return -1;
+}
+
+int
+netmsg_uring_attach(struct netmsg_io *io, int mode)
+{
+	assert(mode == NETMSG_IO_URING || mode == NETMSG_IO_URING_WRITE);
+	if (uring_init() < 0)
+		return -1;
+
+	struct netmsg_uring *u = xcalloc(1, sizeof(*u));
+	u->recv = (struct netmsg_uring_op){ .type = URING_RECV, .io = io };
+	u->write = (struct netmsg_uring_op){ .type = URING_WRITE, .io = io };
+	io->uring = u;
+	io->flags |= mode;
+	return 0;
+}
+
+void
+netmsg_uring_recv_start(struct netmsg_io *io)
+{
+	struct netmsg_uring *u = io->uring;
+	u->recv_wanted = true;
+	if (!u->recv_armed)
+		uring_recv_arm(io);
+}
+
+void
+netmsg_uring_recv_stop(struct netmsg_io *io)
+{
+	struct netmsg_uring *u = io->uring;
+	u->recv_wanted = false;
+	if (u->recv_armed && !u->recv_cancel) {
+		uring_cancel(&u->recv);
+		u->recv_cancel = true;
+	}
+}
+
+void
+netmsg_uring_write(struct netmsg_io *io)
+{
+	struct netmsg_uring *u = io->uring;
+	struct netmsg *m;
+
+	if (u->write_busy || io->wbuf.bytes == 0)
+		return;
+
+#if HAVE_DECL_IO_URING_PREP_SENDMSG_ZC
+	if (cfg.io_uring_send_zc > 0 && io->wbuf.bytes >= cfg.io_uring_send_zc &&
+	    netmsg_has_refs(&io->wbuf))
+		return uring_send_zc(io);
+#endif
+
+	int count = 0;
+	TAILQ_FOREACH(m, &io->wbuf.q, link)
+		count += m->count;
+	count = MIN(count, IOV_MAX);
+	if (u->iov_size < count) {
+		u->iov = xrealloc(u->iov, count * sizeof(*u->iov));
+		u->iov_size = count;
+	}
+
+	struct iovec *v = u->iov, *end = u->iov + count;
+	TAILQ_FOREACH_REVERSE(m, &io->wbuf.q, netmsg_tailq, link) {
+		int n = MIN(m->count, end - v);
+		memcpy(v, m->iov, n * sizeof(*v));
+		v += n;
+		if (v == end)
+			break;
+	}
+
+	struct io_uring_sqe *sqe = uring_sqe();
+	io_uring_prep_writev(sqe, io->fd, u->iov, count, 0);
+	io_uring_sqe_set_data(sqe, &u->write);
+	uring.writes++;
+	u->write_busy = true;
+	netmsg_io_retain(io);
+}
+
+int
+netmsg_uring_submit(int *writes)
+{
+	if (writes)
+		*writes = 0;
+	if (uring.state != 1 || io_uring_sq_ready(&uring.ring) == 0)
+		return 0;
+	int r = io_uring_submit(&uring.ring);
+	if (r < 0) {
+		errno = -r;
+		say_syserror("io_uring_submit");
+		return 0;
+	}
+	int w = MIN(uring.writes, r);
+	uring.writes -= w;
+	if (writes)
+		*writes = w;
+	return r;
+}
+
+size_t
+netmsg_uring_inflight(struct netmsg_io *io)
+{
+	return io->uring ? io->uring->zc_left : 0;
+}
+
+static void
+netmsg_uring_detach(struct netmsg_io *io)
+{
+	struct netmsg_uring *u = io->uring;
+	netmsg_uring_recv_stop(io);
+	if (u->write_busy)
+		uring_cancel(&u->write);
+	/* operations keep their own reference to the file,
+	   so the descriptor may be closed right after */
+	netmsg_uring_submit(NULL);
+}
+#else
+int netmsg_uring_attach(struct netmsg_io *io _unused_, int mode _unused_) { return -1; }
+void netmsg_uring_recv_start(struct netmsg_io *io _unused_) { abort(); }
+void netmsg_uring_recv_stop(struct netmsg_io *io _unused_) { abort(); }
+void netmsg_uring_write(struct netmsg_io *io _unused_) { abort(); }
+int netmsg_uring_submit(int *writes) { if (writes) *writes = 0; return 0; }
+size_t netmsg_uring_inflight(struct netmsg_io *io _unused_) { return 0; }
+#endif
+
 void
 netmsg_io_shutdown(struct netmsg_io *io, int how)
 {
@@ -492,23 +1134,74 @@ netmsg_io_shutdown(struct netmsg_io *io, int how)
 		ev_io_stop(&io->in);
 		io->in.fd = -1;
 	}
+	if ((how == SHUT_RD || how == SHUT_RDWR) && io->flags & NETMSG_IO_URING)
+		netmsg_uring_recv_stop(io);
 }
 
 void
 netmsg_io_close(struct netmsg_io* _io)
 {
+	struct netmsg_cursor *c;
+	while ((c = TAILQ_FIRST(&_io->cursors)) != NULL) {
+		TAILQ_REMOVE(&_io->cursors, c, link);
+		c->pull(c, NULL);
+	}
+
 	if (_io->fd < 0)
 		return;
 
 	say_debug ("closing connection to %s [%i]", net_fd_name (_io->fd), _io->fd);
 
 	netmsg_io_shutdown (_io, SHUT_RDWR);
+#if NET_URING
+	if (_io->flags & (NETMSG_IO_URING | NETMSG_IO_URING_WRITE))
+		netmsg_uring_detach(_io);
+#endif
 	if (close (_io->fd) < 0)
 		say_syswarn ("close");
 
 	_io->fd = -1;
 }
 
+void
+netmsg_io_add_cursor(struct netmsg_io *io, struct netmsg_cursor *c)
+{
+	TAILQ_INSERT_TAIL(&io->cursors, c, link);
+	netmsg_io_pull(io, 0);
+}
+
+/* cursors are pulled round robin until enough output is pending.
+   `queued' is output already handed off elsewhere (I/O thread) and not sent yet.
+   returns -1 if pull() raised: connection is closed then */
+int
+netmsg_io_pull(struct netmsg_io *io, size_t queued)
+{
+	struct netmsg_cursor *c;
+	while (io->wbuf.bytes + queued < cfg.output_low_watermark &&
+	       (c = TAILQ_FIRST(&io->cursors)) != NULL)
+	{
+		ssize_t bytes = io->wbuf.bytes;
+		TAILQ_REMOVE(&io->cursors, c, link);
+		@try {
+			if (!c->pull(c, &io->wbuf))
+				continue;
+		}
+		@catch (Error *e) {
+			say_warn("cursor of %s failed: %s", net_fd_name(io->fd), e->reason);
+			[e release];
+			/* wbuf may end with a partial message: the only way out is close,
+			   which also releases the cursor */
+			TAILQ_INSERT_HEAD(&io->cursors, c, link);
+			[io close];
+			return -1;
+		}
+		TAILQ_INSERT_TAIL(&io->cursors, c, link);
+		if (io->wbuf.bytes == bytes) /* nothing ready yet */
+			break;
+	}
+	return 0;
+}
+
 ssize_t
 netmsg_io_write_for_cb(ev_io *ev, int __attribute__((unused)) events)
 {
@@ -521,6 +1214,9 @@ netmsg_io_write_for_cb(ev_io *ev, int __attribute__((unused)) events)
 		return r;
 	}
 
+	if (!TAILQ_EMPTY(&io->cursors) && netmsg_io_pull(io, 0) < 0)
+		return r; /* closed */
+
 	if (io->wbuf.bytes == 0) {
 		ev_io_stop(ev);
 		if (io->flags & NETMSG_IO_LINGER_CLOSE) {
@@ -589,7 +1285,9 @@ netmsg_io_init(struct netmsg_io *io, struct netmsg_pool_ctx *ctx, int fd)
 	netmsg_io_retain(io);
 	netmsg_head_init(&io->wbuf, ctx);
 	io->rbuf = TBUF(NULL, 0, NULL);
+	io->rchunk = NULL;
 	io->ctx = ctx;
+	TAILQ_INIT(&io->cursors);
 	ev_init(&io->in, netmsg_io_read_cb);
 	ev_init(&io->out, netmsg_io_write_cb);
 
@@ -631,6 +1329,11 @@ free
 		[self close];
 	rbuf_reset(self);
 	netmsg_head_dealloc(&wbuf);
+#if NET_URING
+	if (uring)
+		free(uring->iov);
+#endif
+	free(uring);
 	[super free];
 	say_debug2("%s: %p", __func__, self);
 }
@@ -646,6 +1349,19 @@ tac_event:(int)event
 	(void)event;
 }
 
+/* io_uring transport: write of r bytes from wbuf is completed */
+- (void)
+uring_written:(ssize_t)r
+{
+	(void)r;
+	if (wbuf.bytes > 0)
+		netmsg_uring_write(self);
+	else if (flags & NETMSG_IO_LINGER_CLOSE) {
+		netmsg_io_close(self);
+		netmsg_io_release(self);
+	}
+}
+
 - (void)
 shutdown:(int)how
 {
@@ -844,14 +1560,14 @@ sinany(struct sockaddr_in *sin, int port)
 }
 
 int
-server_socket(int type, struct sockaddr *saddr, int nonblock,
+server_socket(int type, struct sockaddr *saddr, int flags,
 	      void (*on_bind)(int fd), void (*sleep)(ev_tstamp tm))
 {
 	int fd;
 	bool warning_said = false;
 	int one = 1;
 	struct linger ling = { 0, 0 };
-	nonblock = !!nonblock;
+	int nonblock = !!(flags & SERVER_SOCKET_NONBLOCK);
 
 	if ((fd = socket(saddr->sa_family, type, 0)) == -1) {
 		say_syserror("socket");
@@ -866,6 +1582,18 @@ server_socket(int type, struct sockaddr *saddr, int nonblock,
 		goto error;
 	}
 
+	if (flags & SERVER_SOCKET_REUSEPORT) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+			say_syserror("setsockopt(SO_REUSEPORT)");
+			goto error;
+		}
+#else
+		say_error("SO_REUSEPORT is not supported");
+		goto error;
+#endif
+	}
+
 	if (type == SOCK_STREAM && saddr->sa_family == AF_INET)
 		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
 			say_syserror("setsockopt");
@@ -883,7 +1611,7 @@ server_socket(int type, struct sockaddr *saddr, int nonblock,
 	const char *saddr_str = saddrtoa(saddr);
 	int saddr_size = saddr->sa_family == AF_INET ?
 			 sizeof(struct sockaddr_in) :
-			 sizeof(struct sockaddr_un);
+			 sunlen((struct sockaddr_un *)saddr);
 retry_bind:
 	if (bind(fd, saddr, saddr_size) == -1) {
 		if (on_bind != NULL)
@@ -928,7 +1656,7 @@ retry_bind:
 	return fd;
 error:
 	if (fd) {
-		if (saddr->sa_family == AF_UNIX)
+		if (saddr->sa_family == AF_UNIX && ((struct sockaddr_un *)saddr)->sun_path[0])
 			unlink(((struct sockaddr_un *)saddr)->sun_path);
 		close(fd);
 	}
@@ -942,8 +1670,9 @@ tcp_server_stop(struct tcp_server_state *state)
 	if (state->io.fd == -1)
 		return;
 
-	if (((struct sockaddr *)&state->saddr)->sa_family == AF_UNIX)
-		unlink(((struct sockaddr_un *)&state->saddr)->sun_path);
+	struct sockaddr_un *sun = (struct sockaddr_un *)&state->saddr;
+	if (sun->sun_family == AF_UNIX && sun->sun_path[0])
+		unlink(sun->sun_path);
 
 	ev_io_stop(&state->io);
 	close(state->io.fd);
@@ -973,7 +1702,7 @@ tcp_server(va_list ap)
 	if (atosaddr(state.addr, (struct sockaddr *)&state.saddr) < 0)
 		return;
 
-	if ((fd = server_socket(SOCK_STREAM, (struct sockaddr *)&state.saddr, 1,
+	if ((fd = server_socket(SOCK_STREAM, (struct sockaddr *)&state.saddr, SERVER_SOCKET_NONBLOCK,
 				state.on_bind, fiber_sleep)) < 0)
 		return;
 
@@ -1048,7 +1777,7 @@ udp_server(va_list ap)
 	if (atosin(addr, &saddr) < 0)
 		return;
 
-	if ((fd = server_socket(SOCK_DGRAM, (struct sockaddr *)&saddr, 1,
+	if ((fd = server_socket(SOCK_DGRAM, (struct sockaddr *)&saddr, SERVER_SOCKET_NONBLOCK,
 				on_bind, NULL)) < 0)
 		return;
 
@@ -1152,6 +1881,8 @@ atosin(const char *orig, struct sockaddr_in *addr)
 	return 0;
 }
 
+/* "@name" denotes a Linux abstract socket: sun_path starts with '\0'
+   and the name is not NUL terminated, its length is carried by socklen */
 int
 atosun(const char *str, struct sockaddr_un *addr)
 {
@@ -1159,15 +1890,27 @@ atosun(const char *str, struct sockaddr_un *addr)
 		say_error("too long addr: %s", str);
 		return -1;
 	}
+	memset(addr, 0, sizeof(*addr));
 	addr->sun_family = AF_UNIX;
 	strcpy(addr->sun_path, str);
+	if (*str == '@')
+		addr->sun_path[0] = 0;
 	return 0;
 }
 
+socklen_t
+sunlen(const struct sockaddr_un *addr)
+{
+	if (addr->sun_path[0] == 0)
+		return offsetof(struct sockaddr_un, sun_path) + 1 +
+			strlen(addr->sun_path + 1);
+	return sizeof(*addr);
+}
+
 int
 atosaddr(const char *str, struct sockaddr *addr)
 {
-	if ((*str == '.' && *(str + 1) == '/') || *str == '/')
+	if ((*str == '.' && *(str + 1) == '/') || *str == '/' || *str == '@')
 		return atosun(str, (struct sockaddr_un *)addr);
 	else
 		return atosin(str, (struct sockaddr_in *)addr);
@@ -1187,7 +1930,14 @@ saddrtoa(const struct sockaddr *addr)
 {
 	switch (addr->sa_family) {
 	case AF_INET: return sintoa((const struct sockaddr_in *)addr);
-	case AF_UNIX: return ((struct sockaddr_un *)addr)->sun_path;
+	case AF_UNIX: {
+		const struct sockaddr_un *sun = (const struct sockaddr_un *)addr;
+		static char buf[sizeof(sun->sun_path) + 1];
+		if (sun->sun_path[0] != 0)
+			return sun->sun_path;
+		snprintf(buf, sizeof(buf), "@%s", sun->sun_path + 1);
+		return buf;
+	}
 	default: assert(false);
 	}
 }
@@ -1259,6 +2009,10 @@ net_fixup_addr(char **addr, int port)
 
 	assert(*addr);
 
+	/* port doesn't apply to unix sockets */
+	if (**addr == '/' || **addr == '@' || strncmp(*addr, "./", 2) == 0)
+		return 0;
+
 	if (port) {
 		if (strlen(*addr) == 0) { /* special case for INADDR_ANY, compat with prev. versions */
 			char *tmp = malloc(6);
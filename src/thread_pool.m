@@ -339,11 +339,21 @@ thread_responses_callbacks_fiber_loop(va_list va)
 				yield();
 			}
 			errno = res.eno;
+			if (res.cb == NULL) { /* thread exited */
+				if (--queue->closing == 0)
+					goto closed;
+				continue;
+			}
 			res.cb(res.cb_arg, res.result, res.error);
 			unzero_io_collect_interval();
 		}
 		fiber_gc();
 	}
+closed:
+	if (queue->ev_started)
+		ev_io_stop(&queue->ev);
+	thread_responses_finalize(queue);
+	fiber_wake(queue->closer, NULL);
 }
 
 static void *
@@ -490,6 +500,14 @@ close
 	}
 }
 
+- (id)
+free
+{
+	thread_requests_finalize(&requests);
+	free(threads);
+	return [super free];
+}
+
 @end
 
 @implementation ThreadPool
@@ -523,6 +541,21 @@ call_callback(request_arg arg, i64 res, id error)
 	fiber_wake(cr->fib, NULL);
 }
 
+/* must be called by a fiber when no request is pending, [free] is
+   allowed after it returns */
+- (void)
+close
+{
+	responses.closing = threadn;
+	responses.closer = fiber;
+	[super close];
+	/* every thread answers its stop request, reader fiber exits
+	   after the last one */
+	while (responses.closing > 0)
+		yield();
+	resrdr = NULL;
+}
+
 - (i64)
 call: (request_arg)arg
 {
@@ -0,0 +1,756 @@
+/*
+ * Copyright (C) 2016 Mail.RU
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include "art.h"
+#if !defined(USE_SSE) && __SSE2__ && HAVE_IMMINTRIN_H
+#define USE_SSE 1
+#endif
+#if USE_SSE
+#include <immintrin.h>
+#endif
+
+enum { ART_NODE4 = 1, ART_NODE16, ART_NODE48, ART_NODE256 };
+#define ART_PREFIX 8
+
+typedef struct art_node {
+	uint32_t prefix_len; /* full length, only ART_PREFIX bytes are stored */
+	uint16_t count;
+	uint8_t type;
+	uint8_t prefix[ART_PREFIX];
+} art_node;
+
+typedef struct {
+	art_node n;
+	uint8_t keys[4];
+	void *child[4];
+} art_node4;
+
+typedef struct {
+	art_node n;
+	uint8_t keys[16];
+	void *child[16];
+} art_node16;
+
+typedef struct {
+	art_node n;
+	uint8_t index[256]; /* slot + 1, 0 if there is no child */
+	void *child[48];
+} art_node48;
+
+typedef struct {
+	art_node n;
+	void *child[256];
+} art_node256;
+
+#define IS_LEAF(p) ((uintptr_t)(p) & 1)
+#define LEAF(obj) ((void *)((uintptr_t)(obj) | 1))
+#define LEAF_OBJ(p) ((void *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static const size_t art_node_size[] = {
+	[ART_NODE4] = sizeof(art_node4),
+	[ART_NODE16] = sizeof(art_node16),
+	[ART_NODE48] = sizeof(art_node48),
+	[ART_NODE256] = sizeof(art_node256),
+};
+
+static art_node *
+art_alloc(struct art *t, int type)
+{
+	art_node *n = calloc(1, art_node_size[type]);
+	if (n == NULL)
+		abort();
+	n->type = type;
+	t->nodes++;
+	t->bytes += art_node_size[type];
+	return n;
+}
+
+static void
+art_free(struct art *t, art_node *n)
+{
+	t->nodes--;
+	t->bytes -= art_node_size[n->type];
+	free(n);
+}
+
+static void
+art_copy_header(art_node *to, const art_node *from)
+{
+	to->prefix_len = from->prefix_len;
+	to->count = from->count;
+	memcpy(to->prefix, from->prefix, MIN(from->prefix_len, ART_PREFIX));
+}
+
+static void **
+art_find_child(art_node *n, uint8_t b)
+{
+	switch (n->type) {
+	case ART_NODE4: {
+		art_node4 *p = (art_node4 *)n;
+		for (int i = 0; i < n->count; i++)
+			if (p->keys[i] == b)
+				return &p->child[i];
+		return NULL;
+	}
+	case ART_NODE16: {
+		art_node16 *p = (art_node16 *)n;
+#if USE_SSE
+		__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(b),
+					     _mm_loadu_si128((__m128i *)p->keys));
+		unsigned mask = _mm_movemask_epi8(cmp) & ((1u << n->count) - 1);
+		return mask ? &p->child[__builtin_ctz(mask)] : NULL;
+#else
+		for (int i = 0; i < n->count; i++)
+			if (p->keys[i] == b)
+				return &p->child[i];
+		return NULL;
+#endif
+	}
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)n;
+		return p->index[b] ? &p->child[p->index[b] - 1] : NULL;
+	}
+	case ART_NODE256: {
+		art_node256 *p = (art_node256 *)n;
+		return p->child[b] ? &p->child[b] : NULL;
+	}
+	}
+	abort();
+}
+
+static void *
+art_minimum(void *p)
+{
+	while (!IS_LEAF(p)) {
+		art_node *n = p;
+		int i = 0;
+		switch (n->type) {
+		case ART_NODE4: p = ((art_node4 *)n)->child[0]; break;
+		case ART_NODE16: p = ((art_node16 *)n)->child[0]; break;
+		case ART_NODE48:
+			while (!((art_node48 *)n)->index[i]) i++;
+			p = ((art_node48 *)n)->child[((art_node48 *)n)->index[i] - 1];
+			break;
+		case ART_NODE256:
+			while (!((art_node256 *)n)->child[i]) i++;
+			p = ((art_node256 *)n)->child[i];
+			break;
+		}
+	}
+	return LEAF_OBJ(p);
+}
+
+/* grows node if it is full, *ref points to the node */
+static void
+art_add_child(struct art *t, void **ref, art_node *n, uint8_t b, void *child)
+{
+	switch (n->type) {
+	case ART_NODE4: {
+		art_node4 *p = (art_node4 *)n;
+		if (n->count < 4) {
+			int i = 0;
+			while (i < n->count && p->keys[i] < b) i++;
+			memmove(p->keys + i + 1, p->keys + i, n->count - i);
+			memmove(p->child + i + 1, p->child + i, (n->count - i) * sizeof(void *));
+			p->keys[i] = b;
+			p->child[i] = child;
+			n->count++;
+			return;
+		}
+		art_node16 *g = (art_node16 *)art_alloc(t, ART_NODE16);
+		art_copy_header(&g->n, n);
+		memcpy(g->keys, p->keys, 4);
+		memcpy(g->child, p->child, 4 * sizeof(void *));
+		*ref = g;
+		art_free(t, n);
+		art_add_child(t, ref, &g->n, b, child);
+		return;
+	}
+	case ART_NODE16: {
+		art_node16 *p = (art_node16 *)n;
+		if (n->count < 16) {
+			int i = 0;
+			while (i < n->count && p->keys[i] < b) i++;
+			memmove(p->keys + i + 1, p->keys + i, n->count - i);
+			memmove(p->child + i + 1, p->child + i, (n->count - i) * sizeof(void *));
+			p->keys[i] = b;
+			p->child[i] = child;
+			n->count++;
+			return;
+		}
+		art_node48 *g = (art_node48 *)art_alloc(t, ART_NODE48);
+		art_copy_header(&g->n, n);
+		for (int i = 0; i < 16; i++) {
+			g->child[i] = p->child[i];
+			g->index[p->keys[i]] = i + 1;
+		}
+		*ref = g;
+		art_free(t, n);
+		art_add_child(t, ref, &g->n, b, child);
+		return;
+	}
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)n;
+		if (n->count < 48) {
+			int i = 0;
+			while (p->child[i]) i++;
+			p->child[i] = child;
+			p->index[b] = i + 1;
+			n->count++;
+			return;
+		}
+		art_node256 *g = (art_node256 *)art_alloc(t, ART_NODE256);
+		art_copy_header(&g->n, n);
+		for (int i = 0; i < 256; i++)
+			if (p->index[i])
+				g->child[i] = p->child[p->index[i] - 1];
+		*ref = g;
+		art_free(t, n);
+		art_add_child(t, ref, &g->n, b, child);
+		return;
+	}
+	case ART_NODE256: {
+		art_node256 *p = (art_node256 *)n;
+		p->child[b] = child;
+		n->count++;
+		return;
+	}
+	}
+	abort();
+}
+
+/* shrinks node if it became sparse, *ref points to the node */
+static void
+art_remove_child(struct art *t, void **ref, art_node *n, uint8_t b, void **slot)
+{
+	switch (n->type) {
+	case ART_NODE4: {
+		art_node4 *p = (art_node4 *)n;
+		int i = slot - p->child;
+		memmove(p->keys + i, p->keys + i + 1, n->count - i - 1);
+		memmove(p->child + i, p->child + i + 1, (n->count - i - 1) * sizeof(void *));
+		n->count--;
+		if (n->count > 1)
+			return;
+		/* single child takes place of the node, merging prefixes */
+		void *child = p->child[0];
+		if (!IS_LEAF(child)) {
+			art_node *c = child;
+			uint32_t len = n->prefix_len;
+			if (len < ART_PREFIX) {
+				n->prefix[len++] = p->keys[0];
+				uint32_t tail = MIN(c->prefix_len, ART_PREFIX - len);
+				memcpy(n->prefix + len, c->prefix, tail);
+				len += tail;
+			}
+			memcpy(c->prefix, n->prefix, MIN(len, ART_PREFIX));
+			c->prefix_len += n->prefix_len + 1;
+		}
+		*ref = child;
+		art_free(t, n);
+		return;
+	}
+	case ART_NODE16: {
+		art_node16 *p = (art_node16 *)n;
+		int i = slot - p->child;
+		memmove(p->keys + i, p->keys + i + 1, n->count - i - 1);
+		memmove(p->child + i, p->child + i + 1, (n->count - i - 1) * sizeof(void *));
+		n->count--;
+		if (n->count > 3)
+			return;
+		art_node4 *s = (art_node4 *)art_alloc(t, ART_NODE4);
+		art_copy_header(&s->n, n);
+		memcpy(s->keys, p->keys, n->count);
+		memcpy(s->child, p->child, n->count * sizeof(void *));
+		*ref = s;
+		art_free(t, n);
+		return;
+	}
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)n;
+		p->child[p->index[b] - 1] = NULL;
+		p->index[b] = 0;
+		n->count--;
+		if (n->count > 12)
+			return;
+		art_node16 *s = (art_node16 *)art_alloc(t, ART_NODE16);
+		art_copy_header(&s->n, n);
+		for (int i = 0, j = 0; i < 256; i++)
+			if (p->index[i]) {
+				s->keys[j] = i;
+				s->child[j++] = p->child[p->index[i] - 1];
+			}
+		*ref = s;
+		art_free(t, n);
+		return;
+	}
+	case ART_NODE256: {
+		art_node256 *p = (art_node256 *)n;
+		p->child[b] = NULL;
+		n->count--;
+		if (n->count > 37)
+			return;
+		art_node48 *s = (art_node48 *)art_alloc(t, ART_NODE48);
+		art_copy_header(&s->n, n);
+		for (int i = 0, j = 0; i < 256; i++)
+			if (p->child[i]) {
+				s->child[j] = p->child[i];
+				s->index[i] = ++j;
+			}
+		*ref = s;
+		art_free(t, n);
+		return;
+	}
+	}
+	abort();
+}
+
+/* full prefix of the node, taken from a leaf if it isn't stored whole */
+static const uint8_t *
+art_prefix(struct art *t, art_node *n, size_t depth, void *arg)
+{
+	if (n->prefix_len <= ART_PREFIX)
+		return n->prefix;
+	size_t len;
+	const uint8_t *k = t->desc->leafKey(arg, art_minimum(n), &len);
+	assert(len >= depth + n->prefix_len);
+	return k + depth;
+}
+
+/* length of common part of the node prefix and key[depth..len) */
+static uint32_t
+art_prefix_mismatch(struct art *t, art_node *n, const uint8_t *key, size_t len,
+		    size_t depth, void *arg)
+{
+	const uint8_t *p = n->prefix;
+	uint32_t max = MIN(n->prefix_len, len - depth), i = 0;
+	for (; i < MIN(max, ART_PREFIX); i++)
+		if (p[i] != key[depth + i])
+			return i;
+	if (i == max)
+		return i;
+	p = art_prefix(t, n, depth, arg);
+	for (; i < max; i++)
+		if (p[i] != key[depth + i])
+			return i;
+	return i;
+}
+
+static int
+art_leaf_match(struct art *t, void *leaf, const uint8_t *key, size_t len, void *arg)
+{
+	size_t lk_len;
+	const uint8_t *lk = t->desc->leafKey(arg, LEAF_OBJ(leaf), &lk_len);
+	return lk_len == len && memcmp(lk, key, len) == 0;
+}
+
+void *
+art_find(struct art *t, const uint8_t *key, size_t len, void *arg)
+{
+	void *p = t->root;
+	size_t depth = 0;
+	while (p != NULL) {
+		if (IS_LEAF(p))
+			return art_leaf_match(t, p, key, len, arg) ? LEAF_OBJ(p) : NULL;
+		art_node *n = p;
+		if (n->prefix_len) {
+			/* skipped bytes are checked against the leaf */
+			if (depth + n->prefix_len >= len ||
+			    memcmp(n->prefix, key + depth, MIN(n->prefix_len, ART_PREFIX)) != 0)
+				return NULL;
+			depth += n->prefix_len;
+		} else if (depth >= len) {
+			return NULL;
+		}
+		void **c = art_find_child(n, key[depth]);
+		if (c == NULL)
+			return NULL;
+		p = *c;
+		depth++;
+	}
+	return NULL;
+}
+
+void *
+art_insert(struct art *t, const uint8_t *key, size_t len, void *obj, void *arg)
+{
+	void **ref = &t->root;
+	size_t depth = 0;
+	assert(!IS_LEAF(obj));
+	for (;;) {
+		void *p = *ref;
+		if (p == NULL) {
+			*ref = LEAF(obj);
+			t->size++;
+			return NULL;
+		}
+		if (IS_LEAF(p)) {
+			size_t lk_len;
+			const uint8_t *lk = t->desc->leafKey(arg, LEAF_OBJ(p), &lk_len);
+			size_t i = depth;
+			while (i < len && i < lk_len && lk[i] == key[i])
+				i++;
+			if (i == len && i == lk_len) {
+				*ref = LEAF(obj);
+				return LEAF_OBJ(p);
+			}
+			/* keys are prefix free */
+			assert(i < len && i < lk_len);
+			art_node *n = art_alloc(t, ART_NODE4);
+			n->prefix_len = i - depth;
+			memcpy(n->prefix, key + depth, MIN(n->prefix_len, ART_PREFIX));
+			art_add_child(t, ref, n, lk[i], p);
+			art_add_child(t, ref, n, key[i], LEAF(obj));
+			*ref = n;
+			t->size++;
+			return NULL;
+		}
+
+		art_node *n = p;
+		if (n->prefix_len) {
+			uint32_t i = art_prefix_mismatch(t, n, key, len, depth, arg);
+			if (i < n->prefix_len) {
+				assert(depth + i < len);
+				art_node *s = art_alloc(t, ART_NODE4);
+				s->prefix_len = i;
+				memcpy(s->prefix, n->prefix, MIN(i, ART_PREFIX));
+				const uint8_t *rest = art_prefix(t, n, depth, arg) + i;
+				uint8_t b = rest[0];
+				n->prefix_len -= i + 1;
+				memmove(n->prefix, rest + 1, MIN(n->prefix_len, ART_PREFIX));
+				art_add_child(t, ref, s, b, n);
+				art_add_child(t, ref, s, key[depth + i], LEAF(obj));
+				*ref = s;
+				t->size++;
+				return NULL;
+			}
+			depth += n->prefix_len;
+		}
+		assert(depth < len);
+		void **c = art_find_child(n, key[depth]);
+		if (c == NULL) {
+			art_add_child(t, ref, n, key[depth], LEAF(obj));
+			t->size++;
+			return NULL;
+		}
+		ref = c;
+		depth++;
+	}
+}
+
+void *
+art_delete(struct art *t, const uint8_t *key, size_t len, void *arg)
+{
+	void **ref = &t->root, **parent_ref = NULL;
+	art_node *parent = NULL;
+	size_t depth = 0;
+	for (;;) {
+		void *p = *ref;
+		if (p == NULL)
+			return NULL;
+		if (IS_LEAF(p)) {
+			if (!art_leaf_match(t, p, key, len, arg))
+				return NULL;
+			if (parent == NULL)
+				t->root = NULL;
+			else
+				art_remove_child(t, parent_ref, parent, key[depth - 1], ref);
+			t->size--;
+			return LEAF_OBJ(p);
+		}
+		art_node *n = p;
+		if (n->prefix_len) {
+			if (depth + n->prefix_len >= len ||
+			    memcmp(n->prefix, key + depth, MIN(n->prefix_len, ART_PREFIX)) != 0)
+				return NULL;
+			depth += n->prefix_len;
+		} else if (depth >= len) {
+			return NULL;
+		}
+		void **c = art_find_child(n, key[depth]);
+		if (c == NULL)
+			return NULL;
+		parent_ref = ref;
+		parent = n;
+		ref = c;
+		depth++;
+	}
+}
+
+static void
+art_destroy_node(struct art *t, void *p)
+{
+	if (p == NULL || IS_LEAF(p))
+		return;
+	art_node *n = p;
+	switch (n->type) {
+	case ART_NODE4:
+		for (int i = 0; i < n->count; i++)
+			art_destroy_node(t, ((art_node4 *)n)->child[i]);
+		break;
+	case ART_NODE16:
+		for (int i = 0; i < n->count; i++)
+			art_destroy_node(t, ((art_node16 *)n)->child[i]);
+		break;
+	case ART_NODE48:
+		for (int i = 0; i < 48; i++)
+			art_destroy_node(t, ((art_node48 *)n)->child[i]);
+		break;
+	case ART_NODE256:
+		for (int i = 0; i < 256; i++)
+			art_destroy_node(t, ((art_node256 *)n)->child[i]);
+		break;
+	}
+	art_free(t, n);
+}
+
+void
+art_destroy(struct art *t)
+{
+	art_destroy_node(t, t->root);
+	t->root = NULL;
+	t->size = 0;
+}
+
+/*
+ * Iterator keeps the path to the next leaf. Position in node4/16 is an
+ * index of keys[], in node48/256 it is the byte itself.
+ */
+
+static int
+art_end_pos(const art_node *n)
+{
+	return n->type <= ART_NODE16 ? n->count : 256;
+}
+
+static void *
+art_pos_child(art_node *n, int pos)
+{
+	switch (n->type) {
+	case ART_NODE4: return ((art_node4 *)n)->child[pos];
+	case ART_NODE16: return ((art_node16 *)n)->child[pos];
+	case ART_NODE48: return ((art_node48 *)n)->child[((art_node48 *)n)->index[pos] - 1];
+	case ART_NODE256: return ((art_node256 *)n)->child[pos];
+	}
+	abort();
+}
+
+/* next occupied position after `pos' in direction dir, -1 if none */
+static int
+art_next_pos(const art_node *n, int pos, int dir)
+{
+	pos += dir;
+	switch (n->type) {
+	case ART_NODE4:
+	case ART_NODE16:
+		return pos >= 0 && pos < n->count ? pos : -1;
+	case ART_NODE48:
+		while (pos >= 0 && pos < 256 && !((art_node48 *)n)->index[pos])
+			pos += dir;
+		break;
+	case ART_NODE256:
+		while (pos >= 0 && pos < 256 && !((art_node256 *)n)->child[pos])
+			pos += dir;
+		break;
+	}
+	return pos >= 0 && pos < 256 ? pos : -1;
+}
+
+/* position of child `b' or the nearest one after it in direction dir */
+static int
+art_seek_pos(art_node *n, uint8_t b, int dir, int *exact)
+{
+	const uint8_t *keys = NULL;
+	*exact = 0;
+	switch (n->type) {
+	case ART_NODE4: keys = ((art_node4 *)n)->keys; break;
+	case ART_NODE16: keys = ((art_node16 *)n)->keys; break;
+	case ART_NODE48: *exact = ((art_node48 *)n)->index[b] != 0; break;
+	case ART_NODE256: *exact = ((art_node256 *)n)->child[b] != NULL; break;
+	}
+	if (keys == NULL)
+		return *exact ? b : art_next_pos(n, b, dir);
+
+	int i = 0;
+	while (i < n->count && keys[i] < b)
+		i++;
+	*exact = i < n->count && keys[i] == b;
+	if (dir < 0 && !*exact)
+		i--;
+	return i >= 0 && i < n->count ? i : -1;
+}
+
+static void
+art_iter_push(struct art_iter *it, art_node *n, int pos)
+{
+	if (it->depth == it->capa) {
+		struct art_iter_frame *s;
+		if (it->stack == it->inline_stack) {
+			s = malloc(2 * it->capa * sizeof(*s));
+			if (s != NULL)
+				memcpy(s, it->stack, it->depth * sizeof(*s));
+		} else {
+			s = realloc(it->stack, 2 * it->capa * sizeof(*s));
+		}
+		if (s == NULL)
+			abort();
+		it->stack = s;
+		it->capa *= 2;
+	}
+	it->stack[it->depth++] = (struct art_iter_frame){ .node = n, .pos = pos };
+}
+
+/* leftmost or rightmost leaf of the subtree becomes the next one */
+static void
+art_iter_descend(struct art_iter *it, void *p)
+{
+	while (!IS_LEAF(p)) {
+		art_node *n = p;
+		int pos = art_next_pos(n, it->dir > 0 ? -1 : art_end_pos(n), it->dir);
+		art_iter_push(it, n, pos);
+		p = art_pos_child(n, pos);
+	}
+	it->next = LEAF_OBJ(p);
+}
+
+/* the next leaf follows subtree the top of the stack points to */
+static void
+art_iter_advance(struct art_iter *it)
+{
+	while (it->depth > 0) {
+		struct art_iter_frame *f = &it->stack[it->depth - 1];
+		int pos = art_next_pos(f->node, f->pos, it->dir);
+		if (pos >= 0) {
+			f->pos = pos;
+			art_iter_descend(it, art_pos_child(f->node, pos));
+			return;
+		}
+		it->depth--;
+	}
+	it->next = NULL;
+}
+
+static void
+art_iter_reset(struct art_iter *it, int dir)
+{
+	if (it->stack == NULL) {
+		it->stack = it->inline_stack;
+		it->capa = sizeof(it->inline_stack) / sizeof(it->inline_stack[0]);
+	}
+	it->dir = dir;
+	it->depth = 0;
+	it->next = NULL;
+}
+
+void
+art_iter_init(struct art_iter *it, struct art *t, int dir)
+{
+	art_iter_reset(it, dir);
+	if (t->root != NULL)
+		art_iter_descend(it, t->root);
+}
+
+void
+art_iter_seek(struct art_iter *it, struct art *t, int dir,
+	      const uint8_t *key, size_t len, void *arg)
+{
+	void *p = t->root;
+	size_t depth = 0;
+	art_iter_reset(it, dir);
+	if (p == NULL)
+		return;
+	for (;;) {
+		if (IS_LEAF(p)) {
+			size_t lk_len;
+			const uint8_t *lk = t->desc->leafKey(arg, LEAF_OBJ(p), &lk_len);
+			int r = memcmp(lk + depth, key + depth, MIN(lk_len, len) - depth);
+			if (r == 0 && lk_len < len)
+				r = -1;
+			/* key being a prefix of the leaf key matches it */
+			if (r * dir >= 0)
+				it->next = LEAF_OBJ(p);
+			else
+				art_iter_advance(it);
+			return;
+		}
+
+		art_node *n = p;
+		if (n->prefix_len) {
+			const uint8_t *prefix = art_prefix(t, n, depth, arg);
+			uint32_t max = MIN(n->prefix_len, len - depth);
+			int r = memcmp(prefix, key + depth, max);
+			if (r != 0) {
+				/* whole subtree is either before or after the key */
+				if (r * dir > 0)
+					art_iter_descend(it, n);
+				else
+					art_iter_advance(it);
+				return;
+			}
+			depth += max;
+		}
+		if (depth == len) {
+			art_iter_descend(it, n);
+			return;
+		}
+
+		int exact, pos = art_seek_pos(n, key[depth], dir, &exact);
+		if (pos < 0) {
+			art_iter_advance(it);
+			return;
+		}
+		art_iter_push(it, n, pos);
+		p = art_pos_child(n, pos);
+		if (!exact) {
+			art_iter_descend(it, p);
+			return;
+		}
+		depth++;
+	}
+}
+
+void *
+art_iter_next(struct art_iter *it)
+{
+	void *obj = it->next;
+	if (obj != NULL)
+		art_iter_advance(it);
+	return obj;
+}
+
+void
+art_iter_destroy(struct art_iter *it)
+{
+	if (it->stack != it->inline_stack)
+		free(it->stack);
+	it->stack = NULL;
+	it->depth = it->capa = 0;
+	it->next = NULL;
+}
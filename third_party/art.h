@@ -0,0 +1,87 @@
+#ifndef ART_H
+#define ART_H
+/*
+ * Copyright (C) 2016 Mail.RU
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Adaptive radix tree (Leis et al., ICDE 2013) over binary comparable keys:
+ * memcmp() order of keys is the order of iteration. Inner nodes have
+ * 4, 16, 48 or 256 children and grow or shrink with the number of them.
+ * Paths of single child nodes are compressed into a prefix of the node
+ * below; at most ART_PREFIX bytes of it are kept in the node, longer ones
+ * are checked against a leaf (optimistic path compression).
+ *
+ * Leaves are the stored object pointers themselves, low bit of which must
+ * be clear. Keys are not kept in the tree: leafKey() rebuilds the key of
+ * an object when it must be compared. No stored key may be a prefix of
+ * another one.
+ */
+
+struct art_desc {
+	/* key of stored object, valid until next call */
+	const uint8_t *(*leafKey)(void *arg, const void *obj, size_t *len);
+};
+
+struct art {
+	struct art_desc const *desc;
+	void *root;
+	size_t size;
+	size_t nodes;
+	size_t bytes;
+};
+
+/* returns stored object */
+void* art_find(struct art *t, const uint8_t *key, size_t len, void *arg);
+/* returns previous object with equal key, if any */
+void* art_insert(struct art *t, const uint8_t *key, size_t len, void *obj, void *arg);
+/* returns deleted object */
+void* art_delete(struct art *t, const uint8_t *key, size_t len, void *arg);
+void  art_destroy(struct art *t);
+
+/* iterator is invalidated by any modification of the tree */
+struct art_iter_frame {
+	void *node;
+	int pos;
+};
+
+struct art_iter {
+	int dir; /* 1 - ascending, -1 - descending */
+	int depth, capa;
+	struct art_iter_frame *stack, inline_stack[16];
+	void *next;
+};
+
+void  art_iter_init(struct art_iter *it, struct art *t, int dir);
+/* ascending iteration starts at the first key not less than `key',
+   descending one at the last key having `key' as a prefix or less than it */
+void  art_iter_seek(struct art_iter *it, struct art *t, int dir,
+		    const uint8_t *key, size_t len, void *arg);
+void* art_iter_next(struct art_iter *it);
+void  art_iter_destroy(struct art_iter *it);
+
+#endif
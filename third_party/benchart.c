@@ -0,0 +1,208 @@
+/*
+ * micro benchmark of art against nihtree (POSTREE index)
+ *
+ * cc -O2 -msse2 -DHAVE_IMMINTRIN_H=1 -o benchart benchart.c
+ *
+ * objects are records scattered over heap, nihtree keeps pointers to them
+ * in its leaves (as NIHCompactTree does) and extracts the key on every
+ * compare, art rebuilds the key of a leaf once per lookup (as ARTTree does).
+ * "u64" keys are random numbers, "string" keys are 21..35 byte strings
+ * sharing long prefixes. "range" is a seek followed by RANGE steps.
+ * bytes/key is the memory of the index itself, records are not counted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "art.c"
+#include "nihtree/nihtree.c"
+
+struct rec {
+	uint64_t id;
+	char name[48];
+};
+
+#define N	(2 * 1000 * 1000)
+#define RANGE	100
+
+static struct rec **recs;
+static int string_keys;
+static uint8_t leaf_buf[64];
+
+static inline double
+elapsedtime(struct timeval *begin)
+{
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - begin->tv_sec) + (end.tv_usec - begin->tv_usec) / 1.0e+6;
+}
+
+static size_t
+encode(const struct rec *r, uint8_t *p)
+{
+	if (string_keys) {
+		size_t len = strlen(r->name) + 1; /* '\0' terminates the key */
+		memcpy(p, r->name, len);
+		return len;
+	}
+	for (int i = 0; i < 8; i++)
+		p[i] = r->id >> (56 - 8 * i);
+	return 8;
+}
+
+static const uint8_t *
+leaf_key(void *arg, const void *obj, size_t *len)
+{
+	(void)arg;
+	*len = encode(obj, leaf_buf);
+	return leaf_buf;
+}
+
+static const struct art_desc desc = { .leafKey = leaf_key };
+
+static bool
+tuple_2_key(const void *tuple, void *key, void *arg)
+{
+	(void)arg;
+	*(struct rec **)key = *(struct rec **)tuple;
+	return true;
+}
+
+static int
+key_cmp(const void *a, const void *b, void *arg)
+{
+	(void)arg;
+	const struct rec *x = *(struct rec **)a, *y = *(struct rec **)b;
+	if (string_keys)
+		return strcmp(x->name, y->name);
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static size_t nih_bytes;
+
+static void *
+nih_realloc(void *old, size_t size, void *arg)
+{
+	(void)arg;
+	if (old)
+		nih_bytes -= *((size_t *)old - 1);
+	if (size == 0) {
+		free(old ? (size_t *)old - 1 : NULL);
+		return NULL;
+	}
+	size_t *p = realloc(old ? (size_t *)old - 1 : NULL, size + sizeof(size_t));
+	*p = size;
+	nih_bytes += size;
+	return p + 1;
+}
+
+#define REPORT(name, op, t, n) printf("%-8s %-8s %-7s %7.1f ns/op\n", \
+				      string_keys ? "string" : "u64", name, op, (t) * 1e9 / (n))
+
+static void
+run(void)
+{
+	struct timeval begin;
+	uint8_t key[64];
+	size_t len;
+	uint64_t sum = 0;
+
+	srand(1);
+	for (int i = 0; i < N; i++) {
+		struct rec *r = recs[i];
+		r->id = (uint64_t)i * 0x9E3779B97F4A7C15ULL; /* unique */
+		snprintf(r->name, sizeof(r->name), "user:%s%llu",
+			 i % 3 ? "eu-west:" : "us-east-1:", (unsigned long long)r->id);
+	}
+
+	/* art */
+	struct art t = { .desc = &desc };
+	struct art_iter it = { .stack = NULL };
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++) {
+		len = encode(recs[i], key);
+		art_insert(&t, key, len, recs[i], NULL);
+	}
+	REPORT("art", "insert", elapsedtime(&begin), N);
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++) {
+		len = encode(recs[(i * 7919L) % N], key);
+		if (art_find(&t, key, len, NULL) != recs[(i * 7919L) % N])
+			abort();
+	}
+	REPORT("art", "lookup", elapsedtime(&begin), N);
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N / RANGE; i++) {
+		len = encode(recs[(i * 7919L) % N], key);
+		art_iter_seek(&it, &t, 1, key, len, NULL);
+		struct rec *r;
+		for (int j = 0; j < RANGE && (r = art_iter_next(&it)); j++)
+			sum += r->id;
+	}
+	REPORT("art", "range", elapsedtime(&begin), N / RANGE);
+	printf("%-8s %-8s %-7s %7.1f (%zu keys)\n", string_keys ? "string" : "u64",
+	       "art", "bytes", (double)t.bytes / t.size, t.size);
+	art_destroy(&t);
+	art_iter_destroy(&it);
+
+	/* nihtree */
+	nihtree_t tt;
+	nihtree_conf_t tc;
+	nihtree_iter_t *nit = alloca(nihtree_iter_need_size(16));
+	nit->max_height = 16;
+	memset(&tc, 0, sizeof(tc));
+	tc.sizeof_key = sizeof(struct rec *);
+	tc.sizeof_tuple = sizeof(struct rec *);
+	tc.tuple_2_key = tuple_2_key;
+	tc.key_cmp = key_cmp;
+	tc.nhrealloc = nih_realloc;
+	tc.inner_max = 128;
+	tc.leaf_max = 32;
+	nihtree_conf_init(&tc);
+	nihtree_init(&tt);
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		nihtree_insert(&tt, &tc, &recs[i], true);
+	REPORT("nihtree", "insert", elapsedtime(&begin), N);
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++) {
+		struct rec **r = nihtree_find_by_key(&tt, &tc, &recs[(i * 7919L) % N], NULL);
+		if (r == NULL || *r != recs[(i * 7919L) % N])
+			abort();
+	}
+	REPORT("nihtree", "lookup", elapsedtime(&begin), N);
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N / RANGE; i++) {
+		nihtree_iter_init_set(&tt, &tc, nit, &recs[(i * 7919L) % N], nihscan_forward);
+		struct rec **r;
+		for (int j = 0; j < RANGE && (r = nihtree_iter_next(nit)); j++)
+			sum -= (*r)->id;
+	}
+	REPORT("nihtree", "range", elapsedtime(&begin), N / RANGE);
+	printf("%-8s %-8s %-7s %7.1f (%u keys)\n", string_keys ? "string" : "u64",
+	       "nihtree", "bytes", (double)nih_bytes / nihtree_count(&tt), nihtree_count(&tt));
+	nihtree_release(&tt, &tc);
+
+	if (sum != 0)
+		printf("range scans differ\n");
+}
+
+int
+main(void)
+{
+	recs = malloc(N * sizeof(*recs));
+	for (int i = 0; i < N; i++)
+		recs[i] = malloc(sizeof(struct rec));
+	/* shuffle, so neighbour keys are far apart */
+	for (int i = N - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		struct rec *r = recs[i]; recs[i] = recs[j]; recs[j] = r;
+	}
+	run();
+	string_keys = 1;
+	run();
+	return 0;
+}
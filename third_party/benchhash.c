@@ -0,0 +1,287 @@
+/*
+ * micro benchmark of hash index tables
+ *
+ * cc -O2 -I../include -o benchhash benchhash.c
+ *
+ * objects are 32 byte records scattered over heap, the key is the first
+ * field. mhash stores key and pointer in the slot (as Int64Hash does),
+ * mhash generic (as GenHash does) and ptr_hash (as PHash does) compare
+ * keys through the object.
+ * "batch" is the hit test done by *_get_many() in multigets of BATCH keys.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "ptr_hash.c"
+
+#define mh_name _i64
+#define mh_key_t uint64_t
+#define mh_val_t void *
+#define MH_STATIC 1
+#define MH_INCREMENTAL_RESIZE 1
+#define mh_zalloc(size) calloc(1, (size))
+#include <mhash.h>
+
+struct obj {
+	uint64_t id;
+	uint64_t pad[3];
+};
+
+static uint64_t mix(uint64_t k);
+
+/* GenHash layout: slot holds pointer and 7 bit hashik, keys are compared
+   and rehashed through the object (GenHash calls dtor there) */
+#define mh_byte_map 1
+#define mh_may_skip 1
+#define mh_neighbors 2
+#define MH_QUADRATIC_PROBING 1
+#define MH_STATIC 1
+#define MH_INCREMENTAL_RESIZE 1
+#define mh_zalloc(size) calloc(1, (size))
+#define mh_name _gen
+struct gen_slot {
+	struct obj *ptr;
+	uint8_t hsh : 7;
+	uint8_t collision : 1;
+} __attribute__((packed));
+typedef struct gen_slot gen_slot_t;
+#define mh_slot_t gen_slot_t
+#define mh_custom_map
+#define mh_map_t uint8_t
+#define mh_get_hashik(k)      (k % 125 + 1)
+#define mh_exist(h, i)       (mh_slot(h, i)->hsh)
+#define mh_setfree(h, i)      mh_slot(h, i)->hsh = 0
+#define mh_mayequal(h, i, hk) (mh_slot(h, i)->hsh == hk)
+#define mh_setexist(h, i, hk) mh_slot(h, i)->hsh = hk
+#define mh_dirty(h, i)        (mh_slot(h, i)->collision)
+#define mh_setdirty(h, i)     mh_slot(h, i)->collision = 1
+#define mh_slot_copy(h, a, b) (a)->ptr = (b)->ptr
+#define mh_slot_key(h, slot) ((slot)->ptr->id)
+#define mh_slot_key_eq(h, i, key) (mh_slot(h, i)->ptr->id == (key))
+#define mh_slot_set_key(h, slot, key)
+#define mh_hash(h, key) ((uint32_t)mix(key))
+#include <mhash.h>
+
+#define N	(4 * 1000 * 1000)
+#define BATCH	100 /* keys of multiget, N must be its multiple */
+
+static inline double
+elapsedtime(struct timeval *begin)
+{
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - begin->tv_sec) + (end.tv_usec - begin->tv_usec) / 1.0e+6;
+}
+
+static uint64_t
+mix(uint64_t k)
+{
+	uint64_t s = 0xbada5515bad ^ k;
+	s ^= s >> 11; s ^= s >> 13;
+	s *= 0x5851f42d4c957f2dULL;
+	return s;
+}
+
+static uint64_t hash_key(void *arg, uint64_t key) { (void)arg; return mix(key); }
+static uint64_t hash_obj(void *arg, void *o) { (void)arg; return mix(((struct obj *)o)->id); }
+static int equal_key(void *arg, void *o, uint64_t key) { (void)arg; return ((struct obj *)o)->id == key; }
+
+static const struct ptr_hash_desc ph_desc = { .hash = hash_obj, .hashKey = hash_key, .equalToKey = equal_key };
+
+static struct obj **objs;
+static uint64_t *keys, *miss;
+
+#define REPORT(name, op, t) printf("%-16s %-8s %6.1f ns/op\n", name, op, (t) * 1e9 / N)
+
+static inline uint64_t
+nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* worst single insert: stop-the-world rehash shows up here */
+#define WORST_INSERT(name, insert) do {					\
+	uint64_t worst = 0;						\
+	for (int i = 0; i < N; i++) {					\
+		uint64_t t = nsec();					\
+		insert;							\
+		t = nsec() - t;						\
+		if (t > worst)						\
+			worst = t;					\
+	}								\
+	printf("%-16s %-8s %6.1f us\n", name, "worst", worst / 1e3);	\
+} while (0)
+
+static void
+bench_mhash(void)
+{
+	struct timeval begin;
+	struct mh_i64_t *h = mh_i64_init(realloc);
+	long found = 0;
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		mh_i64_put(h, objs[i]->id, objs[i], NULL);
+	REPORT("mhash", "insert", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++) {
+		uint32_t k = mh_i64_get(h, keys[i]);
+		if (k != mh_end(h))
+			found += ((struct obj *)mh_i64_value(h, k))->id == keys[i];
+	}
+	REPORT("mhash", "hit", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		found += mh_i64_get(h, miss[i]) != mh_end(h);
+	REPORT("mhash", "miss", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i += BATCH) {
+		uint32_t x[BATCH];
+		mh_i64_get_many(h, keys + i, BATCH, x);
+		for (int j = 0; j < BATCH; j++)
+			found += ((struct obj *)mh_i64_value(h, x[j]))->id == keys[i + j];
+	}
+	REPORT("mhash", "batch", elapsedtime(&begin));
+	found -= N;
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		mh_i64_remove(h, keys[i], NULL);
+	REPORT("mhash", "delete", elapsedtime(&begin));
+
+	if (found != N || mh_size(h) != 0)
+		abort();
+	mh_i64_destroy(h);
+
+	h = mh_i64_init(realloc);
+	WORST_INSERT("mhash", mh_i64_put(h, objs[i]->id, objs[i], NULL));
+	mh_i64_destroy(h);
+}
+
+static void
+bench_mhash_gen(void)
+{
+	struct timeval begin;
+	struct mh_gen_t *h = mh_gen_init(realloc);
+	long found = 0;
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		mh_gen_sput(h, &(gen_slot_t){ .ptr = objs[i] }, NULL);
+	REPORT("mhash generic", "insert", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		found += mh_gen_sget_by_key(h, keys[i]) != mh_end(h);
+	REPORT("mhash generic", "hit", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		found += mh_gen_sget_by_key(h, miss[i]) != mh_end(h);
+	REPORT("mhash generic", "miss", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i += BATCH) {
+		uint32_t x[BATCH];
+		mh_gen_get_many(h, keys + i, BATCH, x);
+		for (int j = 0; j < BATCH; j++)
+			found += x[j] != mh_end(h);
+	}
+	REPORT("mhash generic", "batch", elapsedtime(&begin));
+	found -= N;
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		mh_gen_sremove_by_key(h, keys[i], NULL);
+	REPORT("mhash generic", "delete", elapsedtime(&begin));
+
+	if (found != N || mh_size(h) != 0)
+		abort();
+	mh_gen_destroy(h);
+
+	h = mh_gen_init(realloc);
+	WORST_INSERT("mhash generic", mh_gen_sput(h, &(gen_slot_t){ .ptr = objs[i] }, NULL));
+	mh_gen_destroy(h);
+}
+
+static void
+bench_ptr_hash(void)
+{
+	struct timeval begin;
+	struct ptr_hash h = { .desc = &ph_desc };
+	long found = 0;
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		ph_insert(&h, objs[i], objs[i]->id, NULL);
+	REPORT("ptr_hash", "insert", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		found += ph_get_key(&h, keys[i], NULL) != NULL;
+	REPORT("ptr_hash", "hit", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		found += ph_get_key(&h, miss[i], NULL) != NULL;
+	REPORT("ptr_hash", "miss", elapsedtime(&begin));
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i += BATCH) {
+		void *o[BATCH];
+		ph_get_many(&h, keys + i, BATCH, o, NULL);
+		for (int j = 0; j < BATCH; j++)
+			found += o[j] != NULL;
+	}
+	REPORT("ptr_hash", "batch", elapsedtime(&begin));
+	found -= N;
+
+	gettimeofday(&begin, NULL);
+	for (int i = 0; i < N; i++)
+		ph_delete_key(&h, keys[i], NULL);
+	REPORT("ptr_hash", "delete", elapsedtime(&begin));
+
+	if (found != N || h.size != 0)
+		abort();
+	ph_destroy(&h, NULL);
+
+	h = (struct ptr_hash){ .desc = &ph_desc };
+	WORST_INSERT("ptr_hash", ph_insert(&h, objs[i], objs[i]->id, NULL));
+	ph_destroy(&h, NULL);
+}
+
+int
+main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+	srand(1);
+	objs = malloc(N * sizeof(*objs));
+	keys = malloc(N * sizeof(*keys));
+	miss = malloc(N * sizeof(*miss));
+
+	for (int i = 0; i < N; i++) {
+		objs[i] = malloc(sizeof(struct obj));
+		objs[i]->id = (uint64_t)i * 2;
+		miss[i] = (uint64_t)rand() * 2 + 1;
+	}
+	/* lookups in random order */
+	for (int i = 0; i < N; i++)
+		keys[i] = (uint64_t)i * 2;
+	for (int i = N - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		uint64_t t = keys[i]; keys[i] = keys[j]; keys[j] = t;
+	}
+
+	bench_mhash();
+	bench_mhash_gen();
+	bench_ptr_hash();
+	return 0;
+}
@@ -628,10 +628,8 @@ restart: {}
 }
 
 static int
-ph_find_key(hash_t *h, uint64_t key, void *arg, size_t *bucket, int *pos)
+ph_find_hashed(hash_t *h, uint64_t key, uint64_t hash, void *arg, size_t *bucket, int *pos)
 {
-	assert(h->desc);
-	uint64_t hash = h->desc->hashKey(arg, key);
 	hshk hashik = ph_hashikof(hash);
 	size_t pos1 = ph_getpos1(h, hash);
 	size_t pos2 = ph_getpos2(h, hash, hashik);
@@ -698,6 +696,14 @@ ph_find_key(hash_t *h, uint64_t key, void *arg, size_t *bucket, int *pos)
 	return 0;
 }
 
+static int
+ph_find_key(hash_t *h, uint64_t key, void *arg, size_t *bucket, int *pos)
+{
+	assert(h->desc);
+	uint64_t hash = h->desc->hashKey(arg, key);
+	return ph_find_hashed(h, key, hash, arg, bucket, pos);
+}
+
 static void
 ph_shrink_backoff(hash_t *h, void *arg)
 {
@@ -830,6 +836,41 @@ ph_get_key(hash_t *h, uint64_t key, void *arg)
 	return NULL;
 }
 
+#define PH_BATCH 16
+void
+ph_get_many(hash_t *h, const uint64_t *keys, size_t n, void **objs, void *arg)
+{
+	uint64_t hash[PH_BATCH];
+	if (h->buckets == NULL) {
+		memset(objs, 0, n * sizeof(*objs));
+		return;
+	}
+	assert(h->desc);
+	for (size_t b = 0; b < n; b += PH_BATCH) {
+		size_t m = n - b < PH_BATCH ? n - b : PH_BATCH;
+		for (size_t i = 0; i < m; i++) {
+			hash[i] = h->desc->hashKey(arg, keys[b + i]);
+			__builtin_prefetch(&h->buckets[ph_getpos1(h, hash[i])]);
+			__builtin_prefetch(&h->buckets[ph_getpos2(h, hash[i], ph_hashikof(hash[i]))]);
+		}
+		/* keys are compared through objects: bring in the likely one */
+		for (size_t i = 0; i < m; i++) {
+			size_t pos1 = ph_getpos1(h, hash[i]);
+			uint32_t res = ph_check_bucket(h, pos1, ph_hashikof(hash[i]));
+			if (res)
+				__builtin_prefetch(TO_PTR(h->buckets[pos1].ptr[ph_next_i(&res)]));
+		}
+		for (size_t i = 0; i < m; i++) {
+			size_t bucket;
+			int pos;
+			if (ph_find_hashed(h, keys[b + i], hash[i], arg, &bucket, &pos))
+				objs[b + i] = TO_PTR(h->buckets[bucket].ptr[pos]);
+			else
+				objs[b + i] = NULL;
+		}
+	}
+}
+
 void *
 ph_delete_key(hash_t *h, uint64_t key, void *arg)
 {
@@ -918,13 +959,16 @@ void
 ph_resize(hash_t *h, size_t size, void *arg)
 {
 	assert(h->desc);
-	assert(h->size == 0);
 	size_t capa = PH_DEFAULT_CAPA();
 	while (capa * BUCKET_SIZE * PH_FILLUPPER < size) {
 		capa *= 2;
 	}
 	if (capa > h->capa) {
 		ph_realloc_nodes(h, capa, arg);
+		/* linear hashing: filled table keeps splitting
+		   a bucket or two per insert, only reserve the room */
+		if (h->size != 0)
+			return;
 		h->border = h->capa;
 		h->watermark = size / BUCKET_SIZE/ PH_FILLUPPER;
 		if (h->watermark < h->border/2) {
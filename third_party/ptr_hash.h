@@ -47,6 +47,8 @@ struct ptr_hash {
 /* key pattern match */
 void* ph_get_key(struct ptr_hash *hash, uint64_t key, void *arg);
 void* ph_delete_key(struct ptr_hash *hash, uint64_t key, void *arg);
+/* ph_get_key() of n keys, buckets of a batch are prefetched before lookup */
+void  ph_get_many(struct ptr_hash *hash, const uint64_t *keys, size_t n, void **objs, void *arg);
 /* returns previous value, if any */
 void* ph_insert(struct ptr_hash *hash, void *obj, uint64_t key, void *arg);
 
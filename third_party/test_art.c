@@ -0,0 +1,235 @@
+/*
+ * randomized test of art against a reference set
+ *
+ * cc -O2 -g -o test_art test_art.c && ./test_art [mode [iterations [seed]]]
+ *
+ * mode 0: 8 byte big endian integer keys, dense and sparse
+ * mode 1: '\0' terminated strings of 1..40 bytes sharing long prefixes,
+ *         long enough to overflow ART_PREFIX
+ * Random inserts, deletes, lookups, seeks and full scans in both directions
+ * are checked against a flag per key of a sorted universe. Node counters
+ * must return to zero after every key is deleted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "art.c"
+
+#define UNIVERSE	(16 * 1024)
+#define KEY_MAX		48
+
+struct obj {
+	size_t len;
+	uint8_t key[KEY_MAX];
+};
+
+static struct obj objs[UNIVERSE];	/* sorted by key */
+static char present[UNIVERSE];
+static size_t present_count;
+static int mode;
+
+static const uint8_t *
+leaf_key(void *arg, const void *obj, size_t *len)
+{
+	assert(arg == (void *)objs);
+	const struct obj *o = obj;
+	*len = o->len;
+	return o->key;
+}
+
+static const struct art_desc desc = { .leafKey = leaf_key };
+
+static int
+key_cmp(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen)
+{
+	int r = memcmp(a, b, alen < blen ? alen : blen);
+	if (r != 0)
+		return r;
+	return alen < blen ? -1 : alen > blen;
+}
+
+static int
+obj_cmp(const void *a, const void *b)
+{
+	const struct obj *x = a, *y = b;
+	return key_cmp(x->key, x->len, y->key, y->len);
+}
+
+static size_t
+gen_key(uint8_t *p)
+{
+	if (mode == 0) {
+		/* both dense runs and random values */
+		uint64_t v = rand() & 1 ? (uint64_t)(rand() % (4 * UNIVERSE)) :
+			     ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 2) ^ rand();
+		for (int i = 0; i < 8; i++)
+			p[i] = v >> (56 - 8 * i);
+		return 8;
+	}
+	static const char *prefix[] = { "", "a", "user:", "user:000000000000000000:",
+					"session/aaaaaaaaaaaaaaaaaaaaaaaaa/" };
+	const char *pre = prefix[rand() % 5];
+	size_t len = strlen(pre), tail = 1 + rand() % 6;
+	memcpy(p, pre, len);
+	for (size_t i = 0; i < tail; i++)
+		p[len++] = "ab0z"[rand() % 4];
+	p[len++] = 0;
+	return len;
+}
+
+static void
+gen_universe(void)
+{
+	size_t n = 0;
+	while (n < UNIVERSE) {
+		objs[n].len = gen_key(objs[n].key);
+		n++;
+		if (n == UNIVERSE) {
+			qsort(objs, n, sizeof(*objs), obj_cmp);
+			size_t u = 1;
+			for (size_t i = 1; i < n; i++)
+				if (obj_cmp(&objs[u - 1], &objs[i]) != 0)
+					objs[u++] = objs[i];
+			n = u;
+		}
+	}
+}
+
+/* reference of art_iter_seek() */
+static int
+ref_seek(const uint8_t *key, size_t len, int dir)
+{
+	if (dir > 0) {
+		for (int i = 0; i < UNIVERSE; i++)
+			if (present[i] && key_cmp(objs[i].key, objs[i].len, key, len) >= 0)
+				return i;
+		return -1;
+	}
+	for (int i = UNIVERSE - 1; i >= 0; i--) {
+		if (!present[i])
+			continue;
+		if (objs[i].len >= len && memcmp(objs[i].key, key, len) == 0)
+			return i;
+		if (key_cmp(objs[i].key, objs[i].len, key, len) < 0)
+			return i;
+	}
+	return -1;
+}
+
+static void
+check_scan(struct art *t, int dir)
+{
+	struct art_iter it = { .stack = NULL };
+	struct obj *o;
+	int i = dir > 0 ? 0 : UNIVERSE - 1;
+	size_t count = 0;
+
+	art_iter_init(&it, t, dir);
+	while ((o = art_iter_next(&it)) != NULL) {
+		while (!present[i])
+			i += dir;
+		assert(o == &objs[i]);
+		i += dir;
+		count++;
+	}
+	art_iter_destroy(&it);
+	assert(count == present_count);
+}
+
+static void
+check_seek(struct art *t)
+{
+	struct art_iter it = { .stack = NULL };
+	uint8_t key[KEY_MAX];
+	size_t len;
+	int dir = rand() & 1 ? 1 : -1;
+
+	if (rand() & 1) {
+		/* existing key, its prefix or a random one */
+		struct obj *o = &objs[rand() % UNIVERSE];
+		len = rand() & 1 ? o->len : (size_t)rand() % (o->len + 1);
+		memcpy(key, o->key, len);
+	} else {
+		len = gen_key(key);
+		if (rand() & 1)
+			len -= rand() % len;
+	}
+
+	int i = ref_seek(key, len, dir);
+	art_iter_seek(&it, t, dir, key, len, objs);
+	for (int n = 0; n < 8; n++) {
+		struct obj *o = art_iter_next(&it);
+		if (i < 0) {
+			assert(o == NULL);
+			break;
+		}
+		assert(o == &objs[i]);
+		do
+			i += dir;
+		while (i >= 0 && i < UNIVERSE && !present[i]);
+		if (i >= UNIVERSE)
+			i = -1;
+	}
+	art_iter_destroy(&it);
+}
+
+int
+main(int argn, char *argv[])
+{
+	struct art t = { .desc = &desc };
+	long iterations = 2000000;
+
+	mode = argn > 1 ? atoi(argv[1]) : 0;
+	if (argn > 2)
+		iterations = atol(argv[2]);
+	srand(argn > 3 ? atoi(argv[3]) : 1);
+	gen_universe();
+
+	for (long n = 0; n < iterations; n++) {
+		int i = rand() % UNIVERSE, op = rand() % 16;
+		struct obj *o = &objs[i];
+
+		if (op < 6) {
+			void *old = art_insert(&t, o->key, o->len, o, objs);
+			assert(old == (present[i] ? o : NULL));
+			present_count += !present[i];
+			present[i] = 1;
+		} else if (op < 11) {
+			void *old = art_delete(&t, o->key, o->len, objs);
+			assert(old == (present[i] ? o : NULL));
+			present_count -= present[i];
+			present[i] = 0;
+		} else if (op < 15) {
+			void *found = art_find(&t, o->key, o->len, objs);
+			assert(found == (present[i] ? o : NULL));
+		} else {
+			check_seek(&t);
+		}
+		assert(t.size == present_count);
+
+		if (n % (iterations / 16 + 1) == 0) {
+			check_scan(&t, 1);
+			check_scan(&t, -1);
+			printf("%ld: %zu keys, %zu nodes, %zu bytes\n",
+			       n, t.size, t.nodes, t.bytes);
+		}
+	}
+	check_scan(&t, 1);
+	check_scan(&t, -1);
+
+	for (int i = 0; i < UNIVERSE; i++) {
+		if (!present[i])
+			continue;
+		void *old = art_delete(&t, objs[i].key, objs[i].len, objs);
+		assert(old == &objs[i]);
+		present[i] = 0;
+		present_count--;
+	}
+	assert(t.size == 0 && t.nodes == 0 && t.bytes == 0 && t.root == NULL);
+	art_destroy(&t);
+	puts("ok");
+	return 0;
+}